@@ -0,0 +1,118 @@
+// This is an independent project of an individual developer. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "AgentsIDTable.h"
+
+AgentsIDTable::AgentsIDTable(void) : _keys(16, -1), _values(16, -1), _size(0)
+{
+}
+
+size_t AgentsIDTable::Slot(long long agentID) const
+{
+	//Capacity is a power of two, so the mask replaces modulo
+	unsigned long long hash = (unsigned long long)agentID * 0x9E3779B97F4A7C15ULL;
+	return (size_t)(hash >> 32) & (_keys.size() - 1);
+}
+
+void AgentsIDTable::Grow()
+{
+	std::vector<long long> oldKeys;
+	std::vector<long long> oldValues;
+	oldKeys.swap(_keys);
+	oldValues.swap(_values);
+	_keys.assign(oldKeys.size() * 2, -1);
+	_values.assign(oldValues.size() * 2, -1);
+	_size = 0;
+
+	for(size_t i = 0; i < oldKeys.size(); i++)
+	{
+		if(oldKeys[i] >= 0)
+		{
+			Insert(oldKeys[i], oldValues[i]);
+		}
+	}
+}
+
+void AgentsIDTable::Insert(long long agentID, long long globalID)
+{
+	if((_size + 1) * 2 > _keys.size()) //load factor is kept below 1/2
+	{
+		Grow();
+	}
+
+	size_t mask = _keys.size() - 1;
+	size_t slot = Slot(agentID);
+	while(_keys[slot] >= 0 && _keys[slot] != agentID)
+	{
+		slot = (slot + 1) & mask;
+	}
+
+	if(_keys[slot] < 0)
+	{
+		_keys[slot] = agentID;
+		_size++;
+	}
+	_values[slot] = globalID;
+}
+
+bool AgentsIDTable::Find(long long agentID, long long &globalID) const
+{
+	size_t mask = _keys.size() - 1;
+	size_t slot = Slot(agentID);
+	while(_keys[slot] >= 0)
+	{
+		if(_keys[slot] == agentID)
+		{
+			globalID = _values[slot];
+			return true;
+		}
+		slot = (slot + 1) & mask;
+	}
+
+	return false;
+}
+
+//Backward shift deletion, so no tombstones are left in the probe chains
+bool AgentsIDTable::Erase(long long agentID)
+{
+	size_t mask = _keys.size() - 1;
+	size_t slot = Slot(agentID);
+	while(_keys[slot] != agentID)
+	{
+		if(_keys[slot] < 0)
+		{
+			return false;
+		}
+		slot = (slot + 1) & mask;
+	}
+
+	size_t next = (slot + 1) & mask;
+	while(_keys[next] >= 0)
+	{
+		size_t home = Slot(_keys[next]);
+		//Entry can be moved to the hole if its home slot is not between the hole and its position
+		if(((next - home) & mask) >= ((next - slot) & mask))
+		{
+			_keys[slot] = _keys[next];
+			_values[slot] = _values[next];
+			slot = next;
+		}
+		next = (next + 1) & mask;
+	}
+
+	_keys[slot] = -1;
+	_values[slot] = -1;
+	_size--;
+	return true;
+}
+
+void AgentsIDTable::Clear()
+{
+	_keys.assign(16, -1);
+	_values.assign(16, -1);
+	_size = 0;
+}
+
+AgentsIDTable::~AgentsIDTable(void)
+{
+}
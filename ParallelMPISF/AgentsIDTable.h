@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+//Open addressing hash table with linear probing: agent ID on node -> global ID. IDs are non-negative, -1 marks an empty slot
+class AgentsIDTable
+{
+public:
+	AgentsIDTable(void);
+	void Insert(long long agentID, long long globalID);
+	bool Find(long long agentID, long long &globalID) const;
+	bool Erase(long long agentID);
+	void Clear();
+	size_t Size() const { return _size; }
+
+	//Slots are iterated directly, empty slots have negative key
+	size_t Capacity() const { return _keys.size(); }
+	long long KeyAt(size_t slot) const { return _keys[slot]; }
+	long long ValueAt(size_t slot) const { return _values[slot]; }
+	~AgentsIDTable(void);
+
+private:
+	size_t Slot(long long agentID) const;
+	void Grow();
+
+	std::vector<long long> _keys;
+	std::vector<long long> _values;
+	size_t _size;
+};
@@ -0,0 +1,120 @@
+// This is an independent project of an individual developer. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "DistributedTrajectoryWriter.h"
+#include <cstring>
+#include <stdexcept>
+
+DistributedTrajectoryWriter::DistributedTrajectoryWriter(const std::string &path, MPI_Comm comm) : _comm(comm), _offset(0), _closed(false)
+{
+	int commSize = 0;
+	MPI_Comm_rank(_comm, &_rank);
+	MPI_Comm_size(_comm, &commSize);
+	_counts.resize(commSize);
+
+	if(MPI_File_open(_comm, const_cast<char*>(path.c_str()), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &_file) != MPI_SUCCESS)
+	{
+		throw std::runtime_error("Cannot open trajectory file " + path);
+	}
+	MPI_File_set_size(_file, 0);
+
+	TrajectoryFileHeader header;
+	memcpy(header.magic, TRAJECTORY_MAGIC, sizeof(header.magic));
+	header.version = TRAJECTORY_FORMAT_VERSION;
+	header.headerSize = sizeof(TrajectoryFileHeader);
+	header.compressed = 0;
+	header.precision = 0;
+	header.keyframeInterval = 0;
+	header.reserved = 0;
+	if(_rank == 0)
+	{
+		MPI_File_write_at(_file, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+	}
+	_offset = sizeof(header);
+}
+
+void DistributedTrajectoryWriter::WriteColumn(long long columnOffset, long long elementsBefore, const void* data, int count, MPI_Datatype type, int elementSize)
+{
+	MPI_File_write_at_all(_file, columnOffset + elementsBefore * elementSize, const_cast<void*>(data), count, type, MPI_STATUS_IGNORE);
+}
+
+//Frame header and padding are written by the root process, every process writes its parts of four columns
+void DistributedTrajectoryWriter::Write(const TrajectoryFrame &frame)
+{
+	int count = frame.ids.size();
+	MPI_Allgather(&count, 1, MPI_INT, &_counts[0], 1, MPI_INT, _comm);
+	long long agentsBefore = 0;
+	long long agentsCount = 0;
+	for(size_t i = 0; i < _counts.size(); i++)
+	{
+		if(i < (size_t)_rank)
+		{
+			agentsBefore += _counts[i];
+		}
+		agentsCount += _counts[i];
+	}
+
+	TrajectoryIndexEntry entry;
+	entry.iteration = frame.iteration;
+	entry.agentsCount = agentsCount;
+	entry.frameOffset = _offset;
+	entry.idsOffset = _offset + sizeof(TrajectoryFrameHeader);
+	entry.flags = TRAJECTORY_FRAME_HAS_IDS;
+	entry.positionsSize = 0;
+
+	long long xOffset = entry.idsOffset + agentsCount * sizeof(long long);
+	long long yOffset = xOffset + agentsCount * sizeof(float);
+	long long flagsOffset = yOffset + agentsCount * sizeof(float);
+	long long frameEnd = flagsOffset + agentsCount * sizeof(unsigned char);
+	int paddingSize = (8 - frameEnd % 8) % 8;
+
+	if(_rank == 0)
+	{
+		TrajectoryFrameHeader frameHeader;
+		frameHeader.iteration = entry.iteration;
+		frameHeader.agentsCount = entry.agentsCount;
+		frameHeader.flags = entry.flags;
+		frameHeader.positionsSize = 0;
+		MPI_File_write_at(_file, entry.frameOffset, &frameHeader, sizeof(frameHeader), MPI_BYTE, MPI_STATUS_IGNORE);
+
+		const char padding[8] = {0};
+		MPI_File_write_at(_file, frameEnd, const_cast<char*>(padding), paddingSize, MPI_BYTE, MPI_STATUS_IGNORE);
+	}
+
+	WriteColumn(entry.idsOffset, agentsBefore, frame.ids.empty() ? NULL : &frame.ids[0], count, MPI_LONG_LONG_INT, sizeof(long long));
+	WriteColumn(xOffset, agentsBefore, frame.xs.empty() ? NULL : &frame.xs[0], count, MPI_FLOAT, sizeof(float));
+	WriteColumn(yOffset, agentsBefore, frame.ys.empty() ? NULL : &frame.ys[0], count, MPI_FLOAT, sizeof(float));
+	WriteColumn(flagsOffset, agentsBefore, frame.flags.empty() ? NULL : &frame.flags[0], count, MPI_UNSIGNED_CHAR, sizeof(unsigned char));
+
+	_offset = frameEnd + paddingSize;
+	if(_rank == 0)
+	{
+		_index.push_back(entry);
+	}
+}
+
+void DistributedTrajectoryWriter::Close()
+{
+	if(_closed)
+	{
+		return;
+	}
+
+	if(_rank == 0)
+	{
+		TrajectoryFileFooter footer;
+		footer.indexOffset = _offset;
+		footer.framesCount = _index.size();
+		memcpy(footer.magic, TRAJECTORY_INDEX_MAGIC, sizeof(footer.magic));
+		MPI_File_write_at(_file, _offset, _index.empty() ? NULL : &_index[0], _index.size() * sizeof(TrajectoryIndexEntry), MPI_BYTE, MPI_STATUS_IGNORE);
+		MPI_File_write_at(_file, _offset + _index.size() * sizeof(TrajectoryIndexEntry), &footer, sizeof(footer), MPI_BYTE, MPI_STATUS_IGNORE);
+	}
+
+	MPI_File_close(&_file);
+	_closed = true;
+}
+
+DistributedTrajectoryWriter::~DistributedTrajectoryWriter(void)
+{
+	Close();
+}
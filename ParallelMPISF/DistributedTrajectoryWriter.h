@@ -0,0 +1,30 @@
+#pragma once
+#include <mpi.h>
+#include <string>
+#include <vector>
+#include "TrajectoryFormat.h"
+
+//Writes trajectory frames into one shared file with collective MPI-IO. Every process writes its parts of the frame columns,
+//parts are placed in ranks order. The file has the same layout as uncompressed TrajectoryWriter files, so TrajectoryReader reads it
+class DistributedTrajectoryWriter
+{
+public:
+	//Collective, all processes of the communicator open the file
+	DistributedTrajectoryWriter(const std::string &path, MPI_Comm comm);
+	//Collective, the frame holds agents of the calling process only. Iteration is taken from the root process
+	void Write(const TrajectoryFrame &frame);
+	//Collective, root process writes the index
+	void Close();
+	~DistributedTrajectoryWriter(void);
+
+private:
+	void WriteColumn(long long columnOffset, long long elementsBefore, const void* data, int count, MPI_Datatype type, int elementSize);
+
+	MPI_Comm _comm;
+	int _rank;
+	MPI_File _file;
+	long long _offset;	//current file size, the same on all processes
+	std::vector<int> _counts;	//agents count of every process in the current frame
+	std::vector<TrajectoryIndexEntry> _index;
+	bool _closed;
+};
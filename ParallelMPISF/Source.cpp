@@ -9,11 +9,42 @@
 #error A scenario is not selected
 #endif
 
+#define VELOCITIES_ASSIGNMENT 1
+//0	Main node sends preferred velocities to workers every iteration
+//1	Workers compute preferred velocities of their agents from replicated scenario goals
+
+#define TRAJECTORY_COMPRESSION 0
+//0	Agents positions are saved as raw floats
+//1	Agents positions are saved as fixed point differences with previous frame, see TrajectoryCodec
+#define TRAJECTORY_PRECISION 0.001f		//fixed point step of compressed positions
+#define TRAJECTORY_KEYFRAME_INTERVAL 10	//compressed frames count between frames which dont depend on previous ones
+
+#define PARTITIONING 1
+//0	Modeling area is divided geometrically into strips across the longer side, strips are divided into areas of equal size
+//1	Recursive coordinate bisection at weighted medians of agents and obstacles density
+//2	Hilbert curve over the weights grid cells is cut into ranges of equal weight, areas are sets of cells
+#define PARTITION_GRID_CELLS 512	//weights grid cells count along the longer side of modeling area
+#define OBSTACLE_WEIGHT 0.5f		//weight of obstacle edge of one cell length, agent weight is 1
+#define EMPTY_CELL_WEIGHT 0.001f
+
+#define REBALANCING_INTERVAL 25				//iterations between load rebalancings, 0 disables rebalancing
+#define REBALANCING_MIGRATION_COST 0.00002	//estimated seconds to move one agent to another node
+#if REBALANCING_INTERVAL > 0 && PARTITIONING == 0
+#error Rebalancing moves bisection or curve cuts, it needs PARTITIONING 1 or 2
+#endif
+
+#define TRAJECTORY_OUTPUT 0
+//0	Main node gathers agents positions and writes trajectory on a background thread
+//1	Every node writes positions of its agents into the shared trajectory file with collective MPI-IO, deleted agents arent saved
+#if TRAJECTORY_OUTPUT == 1 && TRAJECTORY_COMPRESSION == 1
+#error Compressed trajectory is written by main node only
+#endif
+
 
 #include <mpi.h>
 #include <stdio.h>
 
-#include <stdlib.h>     /* srand, rand */
+#include <stdlib.h>     /* strtoull */
 #include <time.h>       /* time */
 #include <iostream>
 #include <fstream>
@@ -31,8 +62,13 @@
 
 
 #include <set>
+#include <algorithm>
+#include <cmath>
 #include <memory>
 #include "AgentOnNodeInfo.h"
+#include "AgentsIDTable.h"
+#include "TrajectoryWriter.h"
+#include "DistributedTrajectoryWriter.h"
 
 #ifdef _WIN32
 #include <process.h>
@@ -52,6 +88,7 @@ using namespace SF;
 
 int myRank, commSize;
 int totalAgentsCount;
+unsigned long long generationSeed; //Seed of agents generating
 string outputFolderPath;
 //std::unique_ptr<SFSimulator> simulator;
 SFSimulator* simulator;
@@ -61,12 +98,118 @@ AgentPropertyConfig* defaultAgentConfig;
 vector<vector<Vector2> > obstacles;
 string modelingDataSavingFile;
 
-map<long long, AgentOnNodeInfo> AgentsIDMap; //Global ID, agent node info
-map<int, map<long long, long long> > NodesAgentsMap;// node id, agent ID on node, gloabal ID;
+//Agents info on main node, arrays are indexed by global ID
+vector<int> AgentsNodeIDs; //node of the agent, -1 if the agent was never added
+vector<long long> AgentsLocalIDs; //agent ID on node
+vector<char> AgentsDeleted;
+vector<Vector2> AgentsPositions;
+vector<AgentsIDTable> NodesAgentsTables; //indexed by node id: agent ID on node -> global ID
 long long totalAgentsIDs = 0; 
-map<long long, Vector2> AgentsPositions;
 int adjacentAreaWidth;
-vector<pair <int, map<long long, pair<Vector2, AgentOnNodeInfo> > > > simulationData;
+vector<int> neighborAreas; //IDs of areas which can exchange phantom agents with area of this node
+
+//Agent position record sent from workers to main node, it is described by agentPositionType
+struct AgentPositionRecord
+{
+	long long agentID; //agent ID on node
+	float x;
+	float y;
+};
+MPI_Datatype agentPositionType;
+//Uniform grid over modeling area, cells are numbered row by row. Points outside of the grid get the nearest border cell
+struct GridGeometry
+{
+	float minX;
+	float minY;
+	float cellSize;
+	int columns;
+	int rows;
+
+	int Column(float x) const
+	{
+		return min(columns - 1, max(0, (int)((x - minX) / cellSize)));
+	}
+	int Row(float y) const
+	{
+		return min(rows - 1, max(0, (int)((y - minY) / cellSize)));
+	}
+	int Cell(float x, float y) const
+	{
+		return Row(y) * columns + Column(x);
+	}
+};
+
+//Expected work in cells of uniform grid over modeling area, used by weighted partitioning
+struct WeightsGrid : GridGeometry
+{
+	vector<double> weights; //row by row
+};
+
+//Areas of every cell of uniform grid over modeling area, lists of all cells are stored one after another.
+//Owner and phantom recipients of a point are found by its cell instead of checking all areas
+struct OwnersGrid : GridGeometry
+{
+	vector<int> ownersStart;	//cells count + 1 offsets in owners
+	vector<int> owners;			//areas which intersect the cell, in IDs order
+	vector<int> haloStart;		//cells count + 1 offsets in halo
+	vector<int> halo;			//areas which intersect the cell when extended by adjacent area width
+	vector<pair<Vector2, Vector2> > areas; //modeling areas by ID, area 0 is empty
+};
+
+//Cells [firstColumn, lastColumn) x [firstRow, lastRow) of WeightsGrid
+struct CellsRange
+{
+	int firstColumn;
+	int firstRow;
+	int lastColumn;
+	int lastRow;
+};
+
+//Cells of the global grid crossing a generating zone. Zone agents are spread over the cells in proportion to the cells parts inside the zone
+//and get global IDs row by row and cell by cell, so IDs of any cell are found without generating agents of other cells
+struct ZoneCells
+{
+	pair<Vector2, Vector2> zone;	//positions range, the zone without its margins
+	int firstColumn;
+	int firstRow;
+	vector<double> widthsBefore;	//widths of the zone parts of the columns before every column, columns count + 1 values
+	vector<double> heightsBefore;	//heights of the zone parts of the rows before every row, rows count + 1 values
+	vector<long long> rowsFirstIDs;	//first global ID of every row, the last value is the first ID after the zone
+};
+
+WeightsGrid partitionGrid; //grid of the bisection, its weights are replaced by measured ones on rebalancing
+vector<CellsRange> areasRanges; //cells of modeling areas, area ID is index + 1
+vector<char> bisectionAxes; //cut axes of the bisection tree in preorder, 1 is vertical cut
+int partitionMinCells; //minimal area width in grid cells
+vector<int> curveCells; //grid cells in Hilbert curve order (PARTITIONING 2)
+vector<int> curveCuts; //curve position of the first cell of every area, area ID is index + 1, the last element is cells count
+vector<int> cellsOwners; //area ID of every grid cell (PARTITIONING 2)
+OwnersGrid ownersGrid; //owners and phantom recipients of grid cells for the current areas
+vector<int> neighborsIndices; //index in neighborAreas by area ID, -1 if the area isnt a neighbor
+double stepsTime = 0; //simulation steps time of this node since the last rebalancing
+
+long long scenarioAgentsNum = 0; //Agents count used by scenario goals (zone A agents have global ID less than half of it)
+map<long long, long long> LocalAgentsGlobalIDs; //agent ID on this node, global ID (workers only)
+//Agents of the worker in arrays, phases read them instead of walking simulator agents. Index in the arrays is the agent handle
+//until the next collecting, arrays are collected after the simulation step and after every change of the agents set
+struct AgentsArrays
+{
+	vector<Agent*> agents;
+	vector<long long> ids;			//agent ID on this node
+	vector<long long> globalIDs;
+	vector<float> xs;
+	vector<float> ys;
+};
+AgentsArrays localAgents;
+vector<float> obstaclesBounds; //min x, min y, max x, max y of every obstacle
+vector<char> obstaclesAdded; //obstacles given to the simulator of this worker
+TrajectoryWriter* trajectoryWriter; //main node only
+DistributedTrajectoryWriter* distributedTrajectoryWriter; //all nodes, TRAJECTORY_OUTPUT 1
+//Main node needs agents positions only to save them or to compute preferred velocities
+const bool mainNodeKeepsPositions = (TRAJECTORY_OUTPUT == 0 || VELOCITIES_ASSIGNMENT == 0);
+//Agents nodes and IDs on nodes are needed by main node for the same work, otherwise workers dont send IDs at all
+const bool mainNodeKeepsIDs = mainNodeKeepsPositions;
+TrajectoryFrame savingFrame; //frame filled by main node, its buffers are recycled by the writer
 
 void LoadData(vector<vector<SF::Vector2> > &obstacles, vector<Vector2> &agentsPositions, pair<Vector2, Vector2> zoneA, pair<Vector2, Vector2> zoneB );
 void SendObstacle(vector<Vector2> obstacle);
@@ -74,47 +217,75 @@ vector<Vector2> ReceiveObstacle();
 void SendAgentPosition(Vector2 agentsPosition);
 Vector2 ReceiveAgentPosition();
 map<int, pair<Vector2, Vector2> > DivideModelingArea(const pair<Vector2, Vector2> &globalArea, int adjacentAreaWidth);
+void SetGridGeometry(GridGeometry &grid, const pair<Vector2, Vector2> &globalArea);
+WeightsGrid BuildWeightsGrid(const pair<Vector2, Vector2> &globalArea);
+double CellsRangeWeight(const WeightsGrid &grid, const CellsRange &range);
+bool BisectCellsRange(const WeightsGrid &grid, const CellsRange &range, int partsNum, int minCells, vector<char> &axes, size_t &axisIndex, vector<CellsRange> &result);
+map<int, pair<Vector2, Vector2> > AreasFromCellsRanges(const WeightsGrid &grid, const vector<CellsRange> &ranges, const pair<Vector2, Vector2> &globalArea);
+map<int, pair<Vector2, Vector2> > BisectModelingArea(const pair<Vector2, Vector2> &globalArea, int adjacentAreaWidth);
+long long HilbertIndex(int order, int x, int y);
+void CutCurve(const WeightsGrid &grid, int partsNum, vector<int> &cuts);
+map<int, pair<Vector2, Vector2> > CurveModelingAreas(const pair<Vector2, Vector2> &globalArea);
+map<int, pair<Vector2, Vector2> > CurveModelingArea(const pair<Vector2, Vector2> &globalArea);
+vector<int> FindCurveNeighborAreas(int areaID);
+void BuildOwnersGrid(const pair<Vector2, Vector2> &globalArea);
+void FindPhantomRecipients(float x, float y, vector<int> &recipients);
+int FindAreaByPoint(float x, float y);
+vector<int> FindNeighborAreas(const map<int, pair<Vector2, Vector2> > &modelingAreas, int areaID, int adjacentAreaWidth);
+void IndexingAreas();
 pair<Vector2, Vector2> CreateModelingArea(vector<vector<Vector2> > &obstacles, Vector2 minPoint, Vector2 maxPoint, float borderWidth);
 int SendAgent(MPIAgent agent, int dest);
-float GenerateRandomBetween(float LO, float HI);
 void SaveObstaclesToJSON(vector<vector<Vector2> > obstacles, const string &path);
 void SavePartitionedAreasToJSON(map<int, pair <Vector2, Vector2> > modelingAreas, const string &path, int adjacentAreaWidth);
 void SaveSimDataToFile(const string &filename, const vector<map<long long, pair<Vector2, AgentOnNodeInfo> > >& simulationData);
 void SaveSimDataToBinaryFile(const string &filename, const vector< pair < int, map<long long, pair<Vector2, AgentOnNodeInfo> > > >& simulationData);
-void WriteToFileBinarySavedModelingInfo(const string &filename, vector<pair<int, map<long long, pair<Vector2, AgentOnNodeInfo> > > >& simulationData);
-void WriteToFilePlainTextSavedModelingInfo(const string &filename, vector<pair<int, map<long long, pair<Vector2, AgentOnNodeInfo> > > >& simulationData);
 const string currentDateTime();
 
 void AgentPropertyConfigBcasting();
-vector<Vector2> ModelingAreaPartitioning(char* argv[]);
+void ModelingAreaPartitioning(char* argv[]);
 void BcastingObstacles();
-void BroadcastingGeneratedAgents(vector<Vector2> agentsPositions);
-vector<Vector2> GenerateRandomAgentsPositionsScenery1();	//a long corridor
-vector<Vector2> GenerateRandomAgentsPositionsScenery2();	//collision of two crowds
-vector<Vector2> GenerateRandomAgentsPositionsScenery3();	//passing through a static crowd
-
+void AddingAreaObstacles();
+unsigned long long CounterBasedRandom(unsigned long long seed, unsigned long long counter);
+float CounterBasedRandomBetween(unsigned long long counter, float LO, float HI);
+void ScenarioGenerationZones(vector<pair<Vector2, Vector2> > &zones, vector<long long> &zonesAgentsNum);
+Vector2 GenerateAgentPosition(long long globalID, const pair<Vector2, Vector2> &rect);
+ZoneCells ZoneGenerationCells(const GridGeometry &grid, const pair<Vector2, Vector2> &zone, long long firstID, long long agentsNum);
+long long ZoneCellFirstID(const ZoneCells &cells, int row, int column);
+pair<Vector2, Vector2> ZoneCellRect(const GridGeometry &grid, const ZoneCells &cells, int row, int column);
+void ZoneCellOfID(const ZoneCells &cells, long long globalID, int &row, int &column);
+void GeneratingAgents();
+void CollectingLocalAgents();
+
+Vector2 ScenarioPreferredVelocity(long long globalID, const Vector2 &position);
 void SendNewVelocities();
+void ComputeNewVelocitiesLocally();
 void ExchangingByPhantoms();
+void CommitAgentPositionType();
 void UpdateAgentsPositionOnMainNode();
 void DoSimulationStep();
 void AgentsShifting();
-void SavingModelingData(int currentIteration, const string &filename);
+void SendingIDsNotices(vector<long long> &idsNotices);
+void RebalancingAreas(int currentIteration, int iterationNum);
+void MigratingAgents();
+void SavingModelingData(int currentIteration);
 
 int main(int argc, char* argv[])
 {
 	try
 	{
 		// code that might throw exception
-		MPI_Init(&argc, &argv);
+		//Only main thread makes MPI calls, main node writes trajectory on a separate thread
+		int threadSupport = 0;
+		MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &threadSupport);
 		MPI_Comm_rank(MPI_COMM_WORLD, &myRank);
 		MPI_Comm_size(MPI_COMM_WORLD, &commSize);
 
 #pragma region ARGUMENTS TREATING
-		if (argc != 8)
+		if (argc != 8 && argc != 9)
 		{
 			if(myRank == 0)
 			{
-				std::cerr << "Error! Invalid number of parameters: " << endl << " min_x min_y max_x max_y agent_calc_radius totalAgentsCount outputFolderPath" << endl;
+				std::cerr << "Error! Invalid number of parameters: " << endl << " min_x min_y max_x max_y agent_calc_radius totalAgentsCount outputFolderPath [seed]" << endl;
 				//cout << "Your parameters" << endl;
 				//for(int i = 0; i < argc; i++)
 				//{
@@ -141,19 +312,46 @@ int main(int argc, char* argv[])
 			MPI_Finalize();
 			return 0;
 		}
+
+		//The same seed gives the same agents population for any nodes count
+		generationSeed = (argc == 9) ? strtoull(argv[8], NULL, 10) : time(NULL);
+		MPI_Bcast(&generationSeed, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+		if(myRank == 0)
+		{
+			std::cout << "Seed: " << generationSeed << endl;
+		}
 #pragma endregion ARGUMENTS TREATING
 
-		modelingDataSavingFile = "simData.data";
-		remove(modelingDataSavingFile.c_str());
+		CommitAgentPositionType();
+		modelingDataSavingFile = "simData.data";	//trajectory writers truncate the file in the output folder
+		clock_t startupStartMoment = clock();
 		simulator = new SFSimulator();
 		AgentPropertyConfigBcasting();
-		vector<Vector2> agentsPositions = ModelingAreaPartitioning(argv);
+		ModelingAreaPartitioning(argv);
 		BcastingObstacles();
-		BroadcastingGeneratedAgents(agentsPositions);
+		clock_t agentsGenerationStartMoment = clock();
+		GeneratingAgents();
+		if(myRank == 0)
+		{
+			printf ("Agents generation time: (%f seconds).\n",((float)clock() - agentsGenerationStartMoment)/CLOCKS_PER_SEC);
+		}
+		if(myRank == 0)
+		{
+			printf ("Startup time: (%f seconds).\n",((float)clock() - startupStartMoment)/CLOCKS_PER_SEC);
+		}
 
-		simulationData.reserve(50);
+		if(TRAJECTORY_OUTPUT == 1)
+		{
+			//Output folder path is passed to all nodes
+			distributedTrajectoryWriter = new DistributedTrajectoryWriter(string(argv[7]) + modelingDataSavingFile, MPI_COMM_WORLD);
+		}
+		else if(myRank == 0)
+		{
+			trajectoryWriter = new TrajectoryWriter(outputFolderPath + modelingDataSavingFile, TRAJECTORY_COMPRESSION == 1, TRAJECTORY_PRECISION, TRAJECTORY_KEYFRAME_INTERVAL);
+		}
 		int iterationNum = 250;
 		int startTime = clock(); //programm working start moment
+		double startWallTime = MPI_Wtime();
 		//int iterationTimeStart;
 
 		for (int iter = 0; iter < iterationNum; iter++)
@@ -164,13 +362,20 @@ int main(int argc, char* argv[])
 			{
 				cout << "Iteration: " << iter << " time: " << currentDateTime() << endl;	
 			}
-			SendNewVelocities();
+			if (VELOCITIES_ASSIGNMENT == 1)
+			{
+				ComputeNewVelocitiesLocally();
+			}
+			else
+			{
+				SendNewVelocities();
+			}
 			clock_t exchangingStartMoment = clock();
 			ExchangingByPhantoms(); //If some agents in adjacent areas
 			printf ("rank: %d Exchanging time: (%f milliseconds).\n", myRank, ((float)clock() - exchangingStartMoment)/(CLOCKS_PER_SEC/1000));
 			if(iter != 0)
 			{
-				SavingModelingData(iter, modelingDataSavingFile);	//Main node put agents positions to list
+				SavingModelingData(iter);	//Agents positions are handed to the trajectory writer
 			}
 			DoSimulationStep();     //Workers perform simulation step
 			//cout<<"simulator fields sizes"<< std::endl;
@@ -186,51 +391,50 @@ int main(int argc, char* argv[])
 			//	cout << "Alive agents " << agentaCountList[1] << endl; 
 			//	cout << "Dead agents " << agentaCountList[2] << endl; 	
 			//}
-			clock_t updatingAgentsPosOnMainNodeStartMoment = clock();
-			UpdateAgentsPositionOnMainNode(); //Workers send agents new positions to main node
-			printf ("rank: %d Updating agents positions on main node time: (%f milliseconds).\n",myRank, ((float)clock() - updatingAgentsPosOnMainNodeStartMoment)/(CLOCKS_PER_SEC/1000));
+			if(mainNodeKeepsPositions)
+			{
+				clock_t updatingAgentsPosOnMainNodeStartMoment = clock();
+				UpdateAgentsPositionOnMainNode(); //Workers send agents new positions to main node
+				printf ("rank: %d Updating agents positions on main node time: (%f milliseconds).\n",myRank, ((float)clock() - updatingAgentsPosOnMainNodeStartMoment)/(CLOCKS_PER_SEC/1000));
+			}
 			AgentsShifting();		//If some agent crossed modeling subarea
+			if(REBALANCING_INTERVAL > 0 && iter % REBALANCING_INTERVAL == REBALANCING_INTERVAL - 1 && iter < iterationNum - 1)
+			{
+				RebalancingAreas(iter, iterationNum);	//Areas borders follow the measured load
+			}
 			if(iter == (iterationNum - 1))
 			{
-				SavingModelingData(iter, modelingDataSavingFile);	//Main node put agents positions to list
+				SavingModelingData(iter);	//Agents positions are handed to the trajectory writer
 			}
 
 			//printf ("Iteration time: (%f seconds).\n",((float)clock() - iterationTimeStart)/CLOCKS_PER_SEC);
 		}
 
-		if (myRank == 0)
+		if(TRAJECTORY_OUTPUT == 1)
+		{
+			distributedTrajectoryWriter->Close();
+			delete distributedTrajectoryWriter;
+			if(myRank == 0)
+			{
+				printf ("program working wall time with data saving: (%f seconds).\n", MPI_Wtime() - startWallTime);
+			}
+		}
+		else if (myRank == 0)
 		{
-			printf ("program working time without data saving: (%f seconds).\n",(clock() - (float)startTime)/CLOCKS_PER_SEC);
-			WriteToFileBinarySavedModelingInfo(modelingDataSavingFile, simulationData);
-			//WriteToFilePlainTextSavedModelingInfo(modelingDataSavingFile, simulationData);
-			//SaveSimDataToBinaryFile("simData.data", simulationData);
-			//SaveSimDataToFile("simData.txt", simulationData);
+			double writerClosingStartMoment = MPI_Wtime();
+			trajectoryWriter->Close();
+			delete trajectoryWriter;
+			printf ("Waiting for trajectory writer time: (%f seconds).\n", MPI_Wtime() - writerClosingStartMoment);
+			printf ("program working wall time with data saving: (%f seconds).\n", MPI_Wtime() - startWallTime);
 		}
 
 		int deletingStartTime = clock();
 		delete defaultAgentConfig;
 		delete simulator;
 
-		//for(map<long long, AgentOnNodeInfo> ::iterator it = AgentsIDMap.begin(); it != AgentsIDMap.end(); ++it)
-		//{
-		//	delete it->second;
-		//}
-		//AgentsIDMap.clear();
-
-		//for(int i = 0; i < simulationData.size(); i++)
-		//{
-		//	for(map<long long, pair<Vector2, AgentOnNodeInfo> >::iterator it = simulationData[i].begin(); it != simulationData[i].end(); ++it)
-		//	{
-		//		delete it->second.first;
-		//		delete it->second.second;
-		//	}
-		//	
-		//	simulationData[i].clear();
-		//}
-		//simulationData.clear();
-
 		printf ("Deleting time:  (%f seconds).\n",((float)clock() - deletingStartTime)/CLOCKS_PER_SEC);
 
+		MPI_Type_free(&agentPositionType);
 		MPI_Finalize();
 		//cout << myRank << " After finalization at:" << clock()<< endl;
 
@@ -264,11 +468,6 @@ int main(int argc, char* argv[])
 	}
 }
 
-float GenerateRandomBetween(float LO, float HI)
-{
-	return LO + static_cast <float> (rand()) / (static_cast <float> (RAND_MAX / (HI - LO)));
-}
-
 void SendObstacle(vector<Vector2> obstacle)
 {
 	int obstaclePointNum = obstacle.size();
@@ -323,336 +522,727 @@ Vector2 ReceiveAgentPosition()
 	return agentPosition;
 }
 
-//Dividing modeling area to subareas for each nodes. If subarea is smaller than minimal width or height it is not dividing more 
+//Geometric division into exactly commSize - 1 areas of equal size, so no worker stays idle for any nodes count.
+//The longer side is divided into strips and every strip into its share of areas along the other side,
+//strips count is chosen so areas are close to squares
 map<int, pair<Vector2, Vector2> > DivideModelingArea(const pair<Vector2, Vector2> &globalArea, int adjacentAreaWidth)
 {
 	float minX = globalArea.first.x();
 	float minY = globalArea.first.y();
 	float maxX = globalArea.second.x();
 	float maxY = globalArea.second.y();
+	bool verticalStrips = maxX - minX >= maxY - minY; //strips go along y axis and divide x
+	float longerSide = max(maxX - minX, maxY - minY);
+	float shorterSide = min(maxX - minX, maxY - minY);
 
-	vector<pair<Vector2, Vector2> > resultAreas;
-	Vector2 pointA(minX, minY);
-	Vector2 pointB(maxX, maxY);
-	pair<Vector2, Vector2> pair_(pointA, pointB);
-	resultAreas.push_back(pair_);
+	int partsNum = max(1, commSize - 1);
+	int stripsNum = (int)floor(sqrt(partsNum * longerSide / max(shorterSide, 1.0f)) + 0.5);
+	stripsNum = max(1, min(partsNum, stripsNum));
 
-	//commSize = 5;
-
-	if (commSize > 2)
+	map<int, pair<Vector2, Vector2> > areas;
+	float minAreaWidth = longerSide;
+	float stripStart = verticalStrips ? minX : minY;
+	int areaID = 1;
+	for(int strip = 0; strip < stripsNum; strip++)
 	{
-		bool tooSmallDivision = false;
-		while (resultAreas.size() < (commSize - 1) && !tooSmallDivision)
+		//Strip width is proportional to its areas count, so all areas have the same size
+		int stripParts = partsNum / stripsNum + (strip < partsNum % stripsNum ? 1 : 0);
+		float stripEnd = (strip == stripsNum - 1) ? (verticalStrips ? maxX : maxY) : stripStart + longerSide * stripParts / partsNum;
+		float partStart = verticalStrips ? minY : minX;
+		for(int part = 0; part < stripParts; part++)
 		{
-			int currIterationVectSize = resultAreas.size();
-			bool areaWasDivided = false;
-			for (int i = 0; i < currIterationVectSize; i++)
+			float partEnd = (part == stripParts - 1) ? (verticalStrips ? maxY : maxX) : partStart + shorterSide / stripParts;
+			if(verticalStrips)
 			{
-				if (resultAreas[i].second.x() - resultAreas[i].first.x() <= resultAreas[i].second.y() - resultAreas[i].first.y()) //horizontal dividing
-				{
-					if((resultAreas[i].second.y() - resultAreas[i].first.y()) / 2 < adjacentAreaWidth)
-					{
-						continue;
-					}
-					float newMaxY = resultAreas[i].first.y() + ((resultAreas[i].second.y() - resultAreas[i].first.y()) / 2);
-					Vector2 pointA2(resultAreas[i].first.x(), newMaxY);
-					Vector2 pointB2(resultAreas[i].second.x(), resultAreas[i].second.y());
-					pair<Vector2, Vector2> pair2(pointA2, pointB2);
-					resultAreas.push_back(pair2);
-
-					Vector2 pointA1(resultAreas[i].first.x(), resultAreas[i].first.y());
-					Vector2 pointB1(resultAreas[i].second.x(), newMaxY);
-					pair<Vector2, Vector2> pair1(pointA1, pointB1);
-					resultAreas[i] = pair1;
-
-					areaWasDivided = true;
-				}
-				else //Vertical dividing
-				{
-					if ((resultAreas[i].second.x() - resultAreas[i].first.x()) / 2 < adjacentAreaWidth)
-					{
-						continue;
-					}
-					float newMaxX = resultAreas[i].first.x() + ((resultAreas[i].second.x() - resultAreas[i].first.x()) / 2);
-					Vector2 pointA2(newMaxX, resultAreas[i].first.y());
-					Vector2 pointB2(resultAreas[i].second.x(), resultAreas[i].second.y());
-					pair<Vector2, Vector2> pair2(pointA2, pointB2);
-					resultAreas.push_back(pair2);
-
-					Vector2 pointA1(resultAreas[i].first.x(), resultAreas[i].first.y());
-					Vector2 pointB1(newMaxX, resultAreas[i].second.y());
-					pair<Vector2, Vector2> pair1(pointA1, pointB1);
-					resultAreas[i] = pair1;
-
-					areaWasDivided = true;
-				}
-
-				if (resultAreas.size() >= commSize - 1)
-				{
-					break;
-				}
+				areas[areaID] = pair<Vector2, Vector2>(Vector2(stripStart, partStart), Vector2(stripEnd, partEnd));
 			}
-
-			if (!areaWasDivided)
+			else
 			{
-				tooSmallDivision = true;
+				areas[areaID] = pair<Vector2, Vector2>(Vector2(partStart, stripStart), Vector2(partEnd, stripEnd));
 			}
+			minAreaWidth = min(minAreaWidth, min(stripEnd - stripStart, partEnd - partStart));
+			partStart = partEnd;
+			areaID++;
 		}
+		stripStart = stripEnd;
 	}
 
-	map<int, pair<Vector2, Vector2> > areas;
-	for(size_t i = 0; i < resultAreas.size(); i++)
+	//Such areas still work, they just send more agents as phantoms
+	if(myRank == 0 && minAreaWidth < adjacentAreaWidth)
 	{
-		areas[i+1] = resultAreas[i];
+		cout << "Some modeling areas are narrower than adjacent area width: " << minAreaWidth << endl;
 	}
 
 	return areas;
 }
 
-void SavePartitionedAreasToJSON(map<int, pair<Vector2, Vector2> > modelingAreas , const string &path, int adjacentAreaWidth)
+//All grids over the global area have the same cells, so cells of weights and owners grids match
+void SetGridGeometry(GridGeometry &grid, const pair<Vector2, Vector2> &globalArea)
 {
-	std::fstream modelingSubareasFile;
-	modelingSubareasFile.open(path.c_str(), ios::out | ios::trunc);
-	modelingSubareasFile << "[" << endl;
-	//for(int i = 0; i < modelingAreas.size(); i++)
-	size_t i = 0;
-	for(map<int, pair<Vector2, Vector2> >::iterator it = modelingAreas.begin(); it != modelingAreas.end(); ++it)
-	{
-		modelingSubareasFile << "{" << endl;
+	float width = globalArea.second.x() - globalArea.first.x();
+	float height = globalArea.second.y() - globalArea.first.y();
+	grid.minX = globalArea.first.x();
+	grid.minY = globalArea.first.y();
+	grid.cellSize = max(width, height) / PARTITION_GRID_CELLS;
+	grid.columns = max(1, (int)ceil(width / grid.cellSize));
+	grid.rows = max(1, (int)ceil(height / grid.cellSize));
+}
 
-		modelingSubareasFile << "\"verticalIndent\":" << adjacentAreaWidth << "," << endl;
-		modelingSubareasFile << "\"horizontalIndent\":" << adjacentAreaWidth << "," << endl;
-		modelingSubareasFile << "\"x1\":" << it->second.first.x() << "," << endl;
-		modelingSubareasFile << "\"y1\":" << it->second.first.y() << "," << endl;
-		modelingSubareasFile << "\"x2\":" << it->second.second.x() << "," << endl;
-		modelingSubareasFile << "\"y2\":" << it->second.second.y() << endl;
+//Expected work over a uniform grid covering the global area: agents count of the scenario population plus obstacles weight in every cell.
+//Agents counts of cells are known from generating zones without positions. Main node has obstacles, the grid is sent to all nodes
+WeightsGrid BuildWeightsGrid(const pair<Vector2, Vector2> &globalArea)
+{
+	WeightsGrid grid;
+	SetGridGeometry(grid, globalArea);
 
-		if(i < modelingAreas.size() - 1)
+	//Empty cells get a small weight, so areas without agents are divided geometrically
+	grid.weights.assign(grid.columns * grid.rows, 0);
+	if(myRank == 0)
+	{
+		vector<pair<Vector2, Vector2> > zones;
+		vector<long long> zonesAgentsNum;
+		ScenarioGenerationZones(zones, zonesAgentsNum);
+		long long zoneFirstID = 0;
+		for(size_t z = 0; z < zones.size(); z++)
 		{
-			modelingSubareasFile << "}," << endl;
+			ZoneCells cells = ZoneGenerationCells(grid, zones[z], zoneFirstID, zonesAgentsNum[z]);
+			int lastColumn = cells.firstColumn + cells.widthsBefore.size() - 1;
+			int lastRow = cells.firstRow + cells.heightsBefore.size() - 1;
+			for(int row = cells.firstRow; row < lastRow; row++)
+			{
+				for(int column = cells.firstColumn; column < lastColumn; column++)
+				{
+					grid.weights[row * grid.columns + column] += ZoneCellFirstID(cells, row, column + 1) - ZoneCellFirstID(cells, row, column);
+				}
+			}
+			zoneFirstID += zonesAgentsNum[z];
 		}
-		else
+
+		for(size_t cell = 0; cell < grid.weights.size(); cell++)
 		{
-			modelingSubareasFile << "}" << endl;
+			grid.weights[cell] += EMPTY_CELL_WEIGHT;
 		}
 
-		i++;
+		//Obstacle edges are sampled with cell size step
+		for(size_t i = 0; i < obstacles.size(); i++)
+		{
+			for(size_t j = 0; j < obstacles[i].size(); j++)
+			{
+				Vector2 a = obstacles[i][j];
+				Vector2 b = obstacles[i][(j + 1) % obstacles[i].size()];
+				float length = sqrt((b.x() - a.x()) * (b.x() - a.x()) + (b.y() - a.y()) * (b.y() - a.y()));
+				int samplesNum = (int)ceil(length / grid.cellSize) + 1;
+				for(int s = 0; s < samplesNum; s++)
+				{
+					float t = (samplesNum == 1) ? 0 : (float)s / (samplesNum - 1);
+					grid.weights[grid.Cell(a.x() + t * (b.x() - a.x()), a.y() + t * (b.y() - a.y()))] += OBSTACLE_WEIGHT * length / grid.cellSize / samplesNum;
+				}
+			}
+		}
 	}
 
-	modelingSubareasFile << "]" << endl;
-	modelingSubareasFile.close();
+	MPI_Bcast(&grid.weights[0], grid.weights.size(), MPI_DOUBLE, 0, MPI_COMM_WORLD);
+	return grid;
 }
 
-vector<Vector2> ModelingAreaPartitioning(char* argv[])
+//Weight of the cells range [firstColumn, lastColumn) x [firstRow, lastRow)
+double CellsRangeWeight(const WeightsGrid &grid, const CellsRange &range)
 {
-	vector<Vector2> agentsPositions;
-
-	Vector2 p1(atoi(argv[1]), atoi(argv[2])); //Minimal point of modeling area
-	Vector2 p2(atoi(argv[3]), atoi(argv[4])); //Maximal point of modeling area
-
-	GlobalArea = CreateModelingArea(obstacles, p1, p2, 1); //Create obstacle around modeling area (rectangle)
-
-	//Agent radius where it interact with anothers
-	adjacentAreaWidth = atoi(argv[5]);
-	//float minimalHeight = atoi(argv[5]);
-
-	totalAgentsCount =  atoi(argv[6]);
-
-	switch(SCENERY) {
-	case 1 :	
-		agentsPositions = GenerateRandomAgentsPositionsScenery1();
-		break;
-	case 2 :	
-		agentsPositions = GenerateRandomAgentsPositionsScenery2();
-		break;
-	case 3 :	
-		agentsPositions = GenerateRandomAgentsPositionsScenery3();
-		break;
-	default:
-		MPI_Finalize();
-		exit(EXIT_FAILURE);			
-	}
-
-	//agentsPositions = GenerateRandomAgentsPositionsScenery2();
-
-	modelingAreas = DivideModelingArea(GlobalArea, adjacentAreaWidth);
-
-	if(myRank == 0)
+	double weight = 0;
+	for(int row = range.firstRow; row < range.lastRow; row++)
 	{
-		SaveObstaclesToJSON(obstacles, outputFolderPath + "_obstacles.txt");
-		SavePartitionedAreasToJSON(modelingAreas , outputFolderPath + "_areas.txt", adjacentAreaWidth);
+		for(int column = range.firstColumn; column < range.lastColumn; column++)
+		{
+			weight += grid.weights[row * grid.columns + column];
+		}
 	}
-
-	return agentsPositions;
+	return weight;
 }
 
-pair<Vector2, Vector2> CreateModelingArea(vector<vector<Vector2> > &obstacles, Vector2 minPoint, Vector2 maxPoint, float borderWidth)
+//Splits the range into partsNum ranges of close weights. The longer side is cut at the weighted median between parts counts of two halves,
+//every part keeps at least minCells cells along the cut axis. Returns false if the range is too small for partsNum parts.
+//Cut axes are taken from axes starting at axisIndex, missing ones are chosen and appended, so a known tree only slides its cuts
+bool BisectCellsRange(const WeightsGrid &grid, const CellsRange &range, int partsNum, int minCells, vector<char> &axes, size_t &axisIndex, vector<CellsRange> &result)
 {
-	vector<Vector2> obstacle;
-	obstacle.push_back(minPoint);
-	obstacle.push_back(Vector2(minPoint.x(), maxPoint.y()));
-	obstacle.push_back(maxPoint);
-	obstacle.push_back(Vector2(maxPoint.x(), minPoint.y()));
-	obstacle.push_back(Vector2(minPoint.x() - borderWidth, minPoint.y()));
-	obstacle.push_back(Vector2(minPoint.x() - borderWidth, minPoint.y() - borderWidth));
-	obstacle.push_back(Vector2(maxPoint.x() + borderWidth, minPoint.y() - borderWidth));
-	obstacle.push_back(Vector2(maxPoint.x() + borderWidth, maxPoint.y() + borderWidth));
-	obstacle.push_back(Vector2(minPoint.x() - borderWidth, maxPoint.y() + borderWidth));
-	obstacle.push_back(Vector2(minPoint.x() - borderWidth, minPoint.y()));
-	obstacle.push_back(minPoint);
-
-	obstacles.push_back(obstacle);
+	if(partsNum == 1)
+	{
+		result.push_back(range);
+		return true;
+	}
 
-	float minX = INT_MAX;
-	float minY = INT_MAX;
-	float maxX = INT_MIN;
-	float maxY = INT_MIN;
+	int leftParts = partsNum / 2;
+	int rightParts = partsNum - leftParts;
+	bool knownAxis = axisIndex < axes.size();
+	bool vertical = knownAxis ? axes[axisIndex] == 1 : range.lastColumn - range.firstColumn >= range.lastRow - range.firstRow; //vertical cut divides columns
+	int first = vertical ? range.firstColumn : range.firstRow;
+	int last = vertical ? range.lastColumn : range.lastRow;
+	if(last - first < partsNum * minCells)
+	{
+		if(knownAxis)
+		{
+			return false;
+		}
+		vertical = !vertical;
+		first = vertical ? range.firstColumn : range.firstRow;
+		last = vertical ? range.lastColumn : range.lastRow;
+		if(last - first < partsNum * minCells)
+		{
+			return false;
+		}
+	}
+	if(!knownAxis)
+	{
+		axes.push_back(vertical ? 1 : 0);
+	}
+	axisIndex++;
 
-	for (size_t i = 0; i < obstacles.size(); i++)
+	//Weights of cells slices across the cut axis
+	vector<double> slices(last - first, 0);
+	for(int row = range.firstRow; row < range.lastRow; row++)
 	{
-		for (size_t j = 0; j < obstacles[i].size(); j++)
+		for(int column = range.firstColumn; column < range.lastColumn; column++)
 		{
-			if (obstacles[i][j].x() < minX)
-			{
-				minX = obstacles[i][j].x();
-			}
-			if (obstacles[i][j].y() < minY)
-			{
-				minY = obstacles[i][j].y();
-			}
-			if (obstacles[i][j].x() > maxX)
-			{
-				maxX = obstacles[i][j].x();
-			}
-			if (obstacles[i][j].y() > maxY)
-			{
-				maxY = obstacles[i][j].y();
-			}
+			slices[(vertical ? column : row) - first] += grid.weights[row * grid.columns + column];
 		}
 	}
+	double totalWeight = 0;
+	for(size_t i = 0; i < slices.size(); i++)
+	{
+		totalWeight += slices[i];
+	}
 
-	Vector2 newMinPoint(minX, minY);
-	Vector2 newMaxPoint(maxX, maxY);
+	double target = totalWeight * leftParts / partsNum;
+	int cut = first + leftParts * minCells;
+	double leftWeight = 0;
+	for(int i = first; i < cut; i++)
+	{
+		leftWeight += slices[i - first];
+	}
+	while(cut < last - rightParts * minCells && fabs(leftWeight + slices[cut - first] - target) < fabs(leftWeight - target))
+	{
+		leftWeight += slices[cut - first];
+		cut++;
+	}
 
-	pair<Vector2, Vector2> globalArea(minPoint, maxPoint);
-	return globalArea;
+	CellsRange leftRange = range;
+	CellsRange rightRange = range;
+	if(vertical)
+	{
+		leftRange.lastColumn = cut;
+		rightRange.firstColumn = cut;
+	}
+	else
+	{
+		leftRange.lastRow = cut;
+		rightRange.firstRow = cut;
+	}
+	return BisectCellsRange(grid, leftRange, leftParts, minCells, axes, axisIndex, result)
+		&& BisectCellsRange(grid, rightRange, rightParts, minCells, axes, axisIndex, result);
+}
 
-	// Border ():
-	//      _______________________
-	//     | ____________________  |
-	//     | |                   | |
-	//     | |                   | |
-	//     | |                   | |
-	//     |_|                   | |
-	//      _                    | |
-	//     | |___________________| |
-	//     |_______________________|
-	//
-	//
+//Areas with IDs from 1 in ranges order. Cells of the last column and row can cross the global area border
+map<int, pair<Vector2, Vector2> > AreasFromCellsRanges(const WeightsGrid &grid, const vector<CellsRange> &ranges, const pair<Vector2, Vector2> &globalArea)
+{
+	map<int, pair<Vector2, Vector2> > areas;
+	for(size_t i = 0; i < ranges.size(); i++)
+	{
+		Vector2 minPoint(grid.minX + ranges[i].firstColumn * grid.cellSize, grid.minY + ranges[i].firstRow * grid.cellSize);
+		Vector2 maxPoint(ranges[i].lastColumn == grid.columns ? globalArea.second.x() : grid.minX + ranges[i].lastColumn * grid.cellSize,
+			ranges[i].lastRow == grid.rows ? globalArea.second.y() : grid.minY + ranges[i].lastRow * grid.cellSize);
+		areas[i + 1] = pair<Vector2, Vector2>(minPoint, maxPoint);
+	}
+	return areas;
 }
 
-void SaveObstaclesToJSON(vector<vector<Vector2> > obstacles, const string &path)
+//Recursive coordinate bisection of the global area by agents and obstacles density, areas get close expected work.
+//The grid, areas cells and the bisection tree are kept for rebalancing
+map<int, pair<Vector2, Vector2> > BisectModelingArea(const pair<Vector2, Vector2> &globalArea, int adjacentAreaWidth)
 {
-	std::fstream agentsPositionsFile;
-	agentsPositionsFile.open(path.c_str(), ios::out | ios::trunc);
-	agentsPositionsFile << "[" << endl;
+	partitionGrid = BuildWeightsGrid(globalArea);
+	CellsRange globalRange = {0, 0, partitionGrid.columns, partitionGrid.rows};
+	partitionMinCells = max(1, (int)ceil(adjacentAreaWidth / partitionGrid.cellSize));
+
+	//Every worker gets an area: if areas cant be as wide as adjacent area the minimal width is decreased,
+	//such areas just send more agents as phantoms. Parts count is decreased only if the grid has less cells than workers
+	int partsNum = max(1, commSize - 1);
+	size_t axisIndex = 0;
+	while(!BisectCellsRange(partitionGrid, globalRange, partsNum, partitionMinCells, bisectionAxes, axisIndex, areasRanges))
+	{
+		areasRanges.clear();
+		bisectionAxes.clear();
+		axisIndex = 0;
+		if(partitionMinCells > 1)
+		{
+			partitionMinCells--;
+		}
+		else
+		{
+			partsNum--;
+		}
+	}
 
-	for(int obst = 0; obst < obstacles.size(); obst++)
+	if(myRank == 0)
 	{
-		agentsPositionsFile << "{" << endl;
-		agentsPositionsFile << "\"obstacleID\": " << obst <<","<< endl;
-		agentsPositionsFile << "\"points\": [" << endl;
-		for(int point = 0; point < obstacles[obst].size(); point++)
+		if(partitionMinCells * partitionGrid.cellSize < adjacentAreaWidth)
 		{
-			agentsPositionsFile << "{" << endl;
-			agentsPositionsFile << "\"X\" : " << obstacles[obst][point].x()<< "," << endl;
-			agentsPositionsFile << "\"Y\" : " << obstacles[obst][point].y() << endl;
-			if(point < obstacles[obst].size() - 1)
-			{
-				agentsPositionsFile << "}," << endl;
-			}
-			else
-			{
-				agentsPositionsFile << "}" << endl;
-			}
+			cout << "Some modeling areas are narrower than adjacent area width: " << partitionMinCells * partitionGrid.cellSize << endl;
 		}
-		agentsPositionsFile << "]" << endl;
-		if(obst < obstacles.size() - 1)
+		if(partsNum < commSize - 1)
 		{
-			agentsPositionsFile << "}," << endl;
+			cout << commSize - 1 - partsNum << " nodes dont get modeling areas" << endl;
 		}
-		else
+		for(size_t i = 0; i < areasRanges.size(); i++)
 		{
-			agentsPositionsFile << "}" << endl;
+			cout << "Area " << i + 1 << " expected load: " << CellsRangeWeight(partitionGrid, areasRanges[i]) << endl;
 		}
 	}
 
-	agentsPositionsFile << "]" << endl;
-	agentsPositionsFile.close();
+	return AreasFromCellsRanges(partitionGrid, areasRanges, globalArea);
 }
 
-void WriteToFilePlainTextSavedModelingInfo(const string &filename, vector<pair<int, map<long long, pair<Vector2, AgentOnNodeInfo> > > >& simulationData)
+//Position of the cell on Hilbert curve filling the square of given order (power of two)
+long long HilbertIndex(int order, int x, int y)
 {
-	int writingToFileStartTime = clock();
-	std::fstream agentsPositionsFile;
-	agentsPositionsFile.open((outputFolderPath + filename).c_str(), ios::out | ios::app);
-
-	for(size_t i = 0; i < simulationData.size(); i++)
+	long long index = 0;
+	for(int s = order / 2; s > 0; s /= 2)
 	{
-		agentsPositionsFile << simulationData[i].first << std::endl; 	//Iteration simulationData[i].first
-		int agentsCount = simulationData[i].second.size();
-		agentsPositionsFile << agentsCount << std::endl;	//int agents count
-		for (std::map<long long, pair<Vector2, AgentOnNodeInfo> >::const_iterator agentsIterator = simulationData[i].second.begin(); agentsIterator !=  simulationData[i].second.end(); ++agentsIterator)
+		int rx = (x & s) > 0 ? 1 : 0;
+		int ry = (y & s) > 0 ? 1 : 0;
+		index += (long long)s * s * ((3 * rx) ^ ry);
+		if(ry == 0)
 		{
-			agentsPositionsFile << agentsIterator->second.second.isDeleted << std::endl;	 //Bool flag is deleted
+			if(rx == 1)
+			{
+				x = order - 1 - x;
+				y = order - 1 - y;
+			}
+			swap(x, y);
+		}
+	}
+	return index;
+}
 
-			agentsPositionsFile << agentsIterator->first << std::endl; //long long agent ID
+//Curve positions where areas start, the last element is cells count. Areas get close weights and at least one cell
+void CutCurve(const WeightsGrid &grid, int partsNum, vector<int> &cuts)
+{
+	int cellsNum = curveCells.size();
+	double totalWeight = 0;
+	for(int position = 0; position < cellsNum; position++)
+	{
+		totalWeight += grid.weights[curveCells[position]];
+	}
 
-			//agentsPositionsFile.write((char*)&agentsIterator->second.second._nodeID, sizeof (agentsIterator->second.second._nodeID));	//int nodeId
+	cuts.assign(1, 0);
+	double accumulatedWeight = 0;
+	int position = 0;
+	for(int part = 1; part < partsNum; part++)
+	{
+		//A cell goes to the area if its middle is before the target weight
+		double target = totalWeight * part / partsNum;
+		while(position < cellsNum - (partsNum - part)
+			&& (position == cuts.back() || accumulatedWeight + grid.weights[curveCells[position]] / 2 <= target))
+		{
+			accumulatedWeight += grid.weights[curveCells[position]];
+			position++;
+		}
+		cuts.push_back(position);
+	}
+	cuts.push_back(cellsNum);
+}
 
-			float x = agentsIterator->second.first.x();
-			agentsPositionsFile << x << std::endl;	//float x
+//Fills cells owners from curve cuts. Modeling areas are bounding boxes of the cells of each area, they are used for rough checks and _areas.txt only
+map<int, pair<Vector2, Vector2> > CurveModelingAreas(const pair<Vector2, Vector2> &globalArea)
+{
+	cellsOwners.assign(partitionGrid.columns * partitionGrid.rows, 0);
+	vector<CellsRange> bounds;
+	for(size_t area = 0; area + 1 < curveCuts.size(); area++)
+	{
+		CellsRange range = {partitionGrid.columns, partitionGrid.rows, 0, 0};
+		for(int position = curveCuts[area]; position < curveCuts[area + 1]; position++)
+		{
+			int cell = curveCells[position];
+			int column = cell % partitionGrid.columns;
+			int row = cell / partitionGrid.columns;
+			cellsOwners[cell] = area + 1;
+			range.firstColumn = min(range.firstColumn, column);
+			range.firstRow = min(range.firstRow, row);
+			range.lastColumn = max(range.lastColumn, column + 1);
+			range.lastRow = max(range.lastRow, row + 1);
+		}
+		bounds.push_back(range);
+	}
+	return AreasFromCellsRanges(partitionGrid, bounds, globalArea);
+}
 
-			float y = agentsIterator->second.first.y();
-			agentsPositionsFile << y << std::endl;	//float y
+//Decomposition by Hilbert curve over the weights grid cells: the curve is cut into contiguous ranges of close weights.
+//The owner of a point is found by its cell and rebalancing only moves cut points
+map<int, pair<Vector2, Vector2> > CurveModelingArea(const pair<Vector2, Vector2> &globalArea)
+{
+	partitionGrid = BuildWeightsGrid(globalArea);
+	int order = 1;
+	while(order < partitionGrid.columns || order < partitionGrid.rows)
+	{
+		order *= 2;
+	}
+
+	vector<pair<long long, int> > indexedCells;
+	for(int row = 0; row < partitionGrid.rows; row++)
+	{
+		for(int column = 0; column < partitionGrid.columns; column++)
+		{
+			indexedCells.push_back(pair<long long, int>(HilbertIndex(order, column, row), row * partitionGrid.columns + column));
 		}
 	}
-	agentsPositionsFile.close();
-	simulationData.clear();
+	sort(indexedCells.begin(), indexedCells.end());
+	curveCells.resize(indexedCells.size());
+	for(size_t position = 0; position < indexedCells.size(); position++)
+	{
+		curveCells[position] = indexedCells[position].second;
+	}
 
-	printf ("Writing to file time: (%f seconds).\n",((float)clock() - writingToFileStartTime)/CLOCKS_PER_SEC);
+	int partsNum = max(1, min(commSize - 1, (int)curveCells.size()));
+	CutCurve(partitionGrid, partsNum, curveCuts);
+
+	if(myRank == 0)
+	{
+		for(int area = 0; area < partsNum; area++)
+		{
+			double load = 0;
+			for(int position = curveCuts[area]; position < curveCuts[area + 1]; position++)
+			{
+				load += partitionGrid.weights[curveCells[position]];
+			}
+			cout << "Area " << area + 1 << " expected load: " << load << endl;
+		}
+	}
+
+	return CurveModelingAreas(globalArea);
 }
 
-void WriteToFileBinarySavedModelingInfo(const string &filename, vector<pair<int, map<long long, pair<Vector2, AgentOnNodeInfo> > > >& simulationData)
+//Areas in halo of cells of given area
+vector<int> FindCurveNeighborAreas(int areaID)
 {
-	int writingToFileStartTime = clock();
-	std::fstream agentsPositionsFile;
-	agentsPositionsFile.open((outputFolderPath + filename).c_str(), ios::out | ios::app | ios::binary);
+	set<int> neighbors;
+	for(size_t cell = 0; cell + 1 < ownersGrid.ownersStart.size(); cell++)
+	{
+		if(ownersGrid.owners[ownersGrid.ownersStart[cell]] != areaID)
+		{
+			continue;
+		}
+		for(int i = ownersGrid.haloStart[cell]; i < ownersGrid.haloStart[cell + 1]; i++)
+		{
+			if(ownersGrid.halo[i] != areaID)
+			{
+				neighbors.insert(ownersGrid.halo[i]);
+			}
+		}
+	}
+	return vector<int>(neighbors.begin(), neighbors.end());
+}
 
-	for(size_t i = 0; i < simulationData.size(); i++)
+//Cells lists of owners and halo for the current modeling areas. Rectangular areas are added to all cells they cross,
+//in PARTITIONING 2 a cell has its curve owner and halo of owners of cells not farther than adjacent area width
+void BuildOwnersGrid(const pair<Vector2, Vector2> &globalArea)
+{
+	SetGridGeometry(ownersGrid, globalArea);
+	int cellsNum = ownersGrid.columns * ownersGrid.rows;
+	vector<vector<int> > cellsAreas(cellsNum);
+	vector<vector<int> > cellsHalo(cellsNum);
+	ownersGrid.areas.assign(modelingAreas.size() + 1, pair<Vector2, Vector2>(Vector2(0, 0), Vector2(0, 0)));
+
+	if(PARTITIONING == 2)
 	{
-		agentsPositionsFile.write((char*)&simulationData[i].first, sizeof (int)); 	//Iteration simulationData[i].first
-		int agentsCount = simulationData[i].second.size();
-		agentsPositionsFile.write((char*)&agentsCount, sizeof (agentsCount));	//int agents count
-		for (std::map<long long, pair<Vector2, AgentOnNodeInfo> >::const_iterator agentsIterator = simulationData[i].second.begin(); agentsIterator !=  simulationData[i].second.end(); ++agentsIterator)
+		int radius = (int)ceil(adjacentAreaWidth / ownersGrid.cellSize);
+		for(int row = 0; row < ownersGrid.rows; row++)
 		{
-			agentsPositionsFile.write((char*)&agentsIterator->second.second.isDeleted, sizeof (agentsIterator->second.second.isDeleted));	 //Bool flag is deleted
+			for(int column = 0; column < ownersGrid.columns; column++)
+			{
+				int owner = cellsOwners[row * ownersGrid.columns + column];
+				cellsAreas[row * ownersGrid.columns + column].push_back(owner);
+				for(int r = max(0, row - radius); r <= min(ownersGrid.rows - 1, row + radius); r++)
+				{
+					for(int c = max(0, column - radius); c <= min(ownersGrid.columns - 1, column + radius); c++)
+					{
+						vector<int> &halo = cellsHalo[r * ownersGrid.columns + c];
+						if(owner != 0 && find(halo.begin(), halo.end(), owner) == halo.end())
+						{
+							halo.push_back(owner);
+						}
+					}
+				}
+			}
+		}
+	}
 
-			agentsPositionsFile.write((char*)&agentsIterator->first, sizeof (agentsIterator->first)); //long long agent ID
+	for(map<int, pair<Vector2, Vector2> >::iterator ar = modelingAreas.begin(); ar != modelingAreas.end(); ++ar)
+	{
+		ownersGrid.areas[ar->first] = ar->second;
+		if(PARTITIONING == 2)
+		{
+			continue;
+		}
 
-			//agentsPositionsFile.write((char*)&agentsIterator->second.second._nodeID, sizeof (agentsIterator->second.second._nodeID));	//int nodeId
+		for(int row = ownersGrid.Row(ar->second.first.y() - adjacentAreaWidth); row <= ownersGrid.Row(ar->second.second.y() + adjacentAreaWidth); row++)
+		{
+			for(int column = ownersGrid.Column(ar->second.first.x() - adjacentAreaWidth); column <= ownersGrid.Column(ar->second.second.x() + adjacentAreaWidth); column++)
+			{
+				cellsHalo[row * ownersGrid.columns + column].push_back(ar->first);
+			}
+		}
+		for(int row = ownersGrid.Row(ar->second.first.y()); row <= ownersGrid.Row(ar->second.second.y()); row++)
+		{
+			for(int column = ownersGrid.Column(ar->second.first.x()); column <= ownersGrid.Column(ar->second.second.x()); column++)
+			{
+				cellsAreas[row * ownersGrid.columns + column].push_back(ar->first);
+			}
+		}
+	}
 
-			float x = agentsIterator->second.first.x();
-			agentsPositionsFile.write((char*)&x, sizeof (x));	//float x
+	ownersGrid.ownersStart.assign(1, 0);
+	ownersGrid.haloStart.assign(1, 0);
+	ownersGrid.owners.clear();
+	ownersGrid.halo.clear();
+	for(int cell = 0; cell < cellsNum; cell++)
+	{
+		ownersGrid.owners.insert(ownersGrid.owners.end(), cellsAreas[cell].begin(), cellsAreas[cell].end());
+		ownersGrid.halo.insert(ownersGrid.halo.end(), cellsHalo[cell].begin(), cellsHalo[cell].end());
+		ownersGrid.ownersStart.push_back(ownersGrid.owners.size());
+		ownersGrid.haloStart.push_back(ownersGrid.halo.size());
+	}
+}
 
-			float y = agentsIterator->second.first.y();
-			agentsPositionsFile.write((char*)&y, sizeof (y));	//float y
+//Other areas which contain the point when extended by adjacent area width, the point gets to them as a phantom
+void FindPhantomRecipients(float x, float y, vector<int> &recipients)
+{
+	recipients.clear();
+	int cell = ownersGrid.Cell(x, y);
+	for(int i = ownersGrid.haloStart[cell]; i < ownersGrid.haloStart[cell + 1]; i++)
+	{
+		int area = ownersGrid.halo[i];
+		const pair<Vector2, Vector2> &bounds = ownersGrid.areas[area];
+		//Curve areas halo is exact up to cells
+		if(area != myRank && (PARTITIONING == 2
+			|| (bounds.first.x() - adjacentAreaWidth <= x && x <= bounds.second.x() + adjacentAreaWidth
+			&& bounds.first.y() - adjacentAreaWidth <= y && y <= bounds.second.y() + adjacentAreaWidth)))
+		{
+			recipients.push_back(area);
 		}
 	}
-	agentsPositionsFile.close();
-	simulationData.clear();
+}
 
-	printf ("Writing to file time: (%f seconds).\n",((float)clock() - writingToFileStartTime)/CLOCKS_PER_SEC);
+//Areas which intersect given area extended by adjacent area width. Only agents of these areas can be phantoms for each other
+vector<int> FindNeighborAreas(const map<int, pair<Vector2, Vector2> > &modelingAreas, int areaID, int adjacentAreaWidth)
+{
+	if(PARTITIONING == 2)
+	{
+		return FindCurveNeighborAreas(areaID);
+	}
+
+	vector<int> neighbors;
+	map<int, pair<Vector2, Vector2> >::const_iterator area = modelingAreas.find(areaID);
+	if(area == modelingAreas.end())
+	{
+		return neighbors;
+	}
+
+	for(map<int, pair<Vector2, Vector2> >::const_iterator it = modelingAreas.begin(); it != modelingAreas.end(); ++it)
+	{
+		if(it->first != areaID
+			&& it->second.first.x() - adjacentAreaWidth		<= area->second.second.x()
+			&& it->second.second.x() + adjacentAreaWidth	>= area->second.first.x()
+			&& it->second.first.y() - adjacentAreaWidth		<= area->second.second.y()
+			&& it->second.second.y() + adjacentAreaWidth	>= area->second.first.y())
+		{
+			neighbors.push_back(it->first);
+		}
+	}
+
+	return neighbors;
+}
+
+//Lookup structures of the current modeling areas, all nodes rebuild them after every partitioning change
+void IndexingAreas()
+{
+	BuildOwnersGrid(GlobalArea);
+	neighborAreas = FindNeighborAreas(modelingAreas, myRank, adjacentAreaWidth);
+	neighborsIndices.assign(modelingAreas.size() + 1, -1);
+	for(size_t nb = 0; nb < neighborAreas.size(); nb++)
+	{
+		neighborsIndices[neighborAreas[nb]] = nb;
+	}
+}
+
+void SavePartitionedAreasToJSON(map<int, pair<Vector2, Vector2> > modelingAreas , const string &path, int adjacentAreaWidth)
+{
+	std::fstream modelingSubareasFile;
+	modelingSubareasFile.open(path.c_str(), ios::out | ios::trunc);
+	modelingSubareasFile << "[" << endl;
+	//for(int i = 0; i < modelingAreas.size(); i++)
+	size_t i = 0;
+	for(map<int, pair<Vector2, Vector2> >::iterator it = modelingAreas.begin(); it != modelingAreas.end(); ++it)
+	{
+		modelingSubareasFile << "{" << endl;
+
+		modelingSubareasFile << "\"verticalIndent\":" << adjacentAreaWidth << "," << endl;
+		modelingSubareasFile << "\"horizontalIndent\":" << adjacentAreaWidth << "," << endl;
+		modelingSubareasFile << "\"x1\":" << it->second.first.x() << "," << endl;
+		modelingSubareasFile << "\"y1\":" << it->second.first.y() << "," << endl;
+		modelingSubareasFile << "\"x2\":" << it->second.second.x() << "," << endl;
+		modelingSubareasFile << "\"y2\":" << it->second.second.y() << endl;
+
+		if(i < modelingAreas.size() - 1)
+		{
+			modelingSubareasFile << "}," << endl;
+		}
+		else
+		{
+			modelingSubareasFile << "}" << endl;
+		}
+
+		i++;
+	}
+
+	modelingSubareasFile << "]" << endl;
+	modelingSubareasFile.close();
+}
+
+void ModelingAreaPartitioning(char* argv[])
+{
+	Vector2 p1(atoi(argv[1]), atoi(argv[2])); //Minimal point of modeling area
+	Vector2 p2(atoi(argv[3]), atoi(argv[4])); //Maximal point of modeling area
+
+	GlobalArea = CreateModelingArea(obstacles, p1, p2, 1); //Create obstacle around modeling area (rectangle)
+
+	//Agent radius where it interact with anothers
+	adjacentAreaWidth = atoi(argv[5]);
+	//float minimalHeight = atoi(argv[5]);
+
+	totalAgentsCount =  atoi(argv[6]);
+
+	if(PARTITIONING == 2)
+	{
+		modelingAreas = CurveModelingArea(GlobalArea);
+	}
+	else if(PARTITIONING == 1)
+	{
+		modelingAreas = BisectModelingArea(GlobalArea, adjacentAreaWidth);
+	}
+	else
+	{
+		modelingAreas = DivideModelingArea(GlobalArea, adjacentAreaWidth);
+	}
+	IndexingAreas();
+
+	if(myRank == 0)
+	{
+		SaveObstaclesToJSON(obstacles, outputFolderPath + "_obstacles.txt");
+		SavePartitionedAreasToJSON(modelingAreas , outputFolderPath + "_areas.txt", adjacentAreaWidth);
+	}
+}
+
+pair<Vector2, Vector2> CreateModelingArea(vector<vector<Vector2> > &obstacles, Vector2 minPoint, Vector2 maxPoint, float borderWidth)
+{
+	vector<Vector2> obstacle;
+	obstacle.push_back(minPoint);
+	obstacle.push_back(Vector2(minPoint.x(), maxPoint.y()));
+	obstacle.push_back(maxPoint);
+	obstacle.push_back(Vector2(maxPoint.x(), minPoint.y()));
+	obstacle.push_back(Vector2(minPoint.x() - borderWidth, minPoint.y()));
+	obstacle.push_back(Vector2(minPoint.x() - borderWidth, minPoint.y() - borderWidth));
+	obstacle.push_back(Vector2(maxPoint.x() + borderWidth, minPoint.y() - borderWidth));
+	obstacle.push_back(Vector2(maxPoint.x() + borderWidth, maxPoint.y() + borderWidth));
+	obstacle.push_back(Vector2(minPoint.x() - borderWidth, maxPoint.y() + borderWidth));
+	obstacle.push_back(Vector2(minPoint.x() - borderWidth, minPoint.y()));
+	obstacle.push_back(minPoint);
+
+	obstacles.push_back(obstacle);
+
+	float minX = INT_MAX;
+	float minY = INT_MAX;
+	float maxX = INT_MIN;
+	float maxY = INT_MIN;
+
+	for (size_t i = 0; i < obstacles.size(); i++)
+	{
+		for (size_t j = 0; j < obstacles[i].size(); j++)
+		{
+			if (obstacles[i][j].x() < minX)
+			{
+				minX = obstacles[i][j].x();
+			}
+			if (obstacles[i][j].y() < minY)
+			{
+				minY = obstacles[i][j].y();
+			}
+			if (obstacles[i][j].x() > maxX)
+			{
+				maxX = obstacles[i][j].x();
+			}
+			if (obstacles[i][j].y() > maxY)
+			{
+				maxY = obstacles[i][j].y();
+			}
+		}
+	}
+
+	Vector2 newMinPoint(minX, minY);
+	Vector2 newMaxPoint(maxX, maxY);
+
+	pair<Vector2, Vector2> globalArea(minPoint, maxPoint);
+	return globalArea;
+
+	// Border ():
+	//      _______________________
+	//     | ____________________  |
+	//     | |                   | |
+	//     | |                   | |
+	//     | |                   | |
+	//     |_|                   | |
+	//      _                    | |
+	//     | |___________________| |
+	//     |_______________________|
+	//
+	//
+}
+
+void SaveObstaclesToJSON(vector<vector<Vector2> > obstacles, const string &path)
+{
+	std::fstream agentsPositionsFile;
+	agentsPositionsFile.open(path.c_str(), ios::out | ios::trunc);
+	agentsPositionsFile << "[" << endl;
+
+	for(int obst = 0; obst < obstacles.size(); obst++)
+	{
+		agentsPositionsFile << "{" << endl;
+		agentsPositionsFile << "\"obstacleID\": " << obst <<","<< endl;
+		agentsPositionsFile << "\"points\": [" << endl;
+		for(int point = 0; point < obstacles[obst].size(); point++)
+		{
+			agentsPositionsFile << "{" << endl;
+			agentsPositionsFile << "\"X\" : " << obstacles[obst][point].x()<< "," << endl;
+			agentsPositionsFile << "\"Y\" : " << obstacles[obst][point].y() << endl;
+			if(point < obstacles[obst].size() - 1)
+			{
+				agentsPositionsFile << "}," << endl;
+			}
+			else
+			{
+				agentsPositionsFile << "}" << endl;
+			}
+		}
+		agentsPositionsFile << "]" << endl;
+		if(obst < obstacles.size() - 1)
+		{
+			agentsPositionsFile << "}," << endl;
+		}
+		else
+		{
+			agentsPositionsFile << "}" << endl;
+		}
+	}
+
+	agentsPositionsFile << "]" << endl;
+	agentsPositionsFile.close();
 }
 
 void SaveSimDataToBinaryFile(const string &filename, const vector< pair < int, map<long long, pair<Vector2, AgentOnNodeInfo> > > >& simulationData)
@@ -784,125 +1374,133 @@ void AgentPropertyConfigBcasting()
 	delete[] serializedDefaultAgentConfig;
 }
 
-vector<Vector2> GenerateRandomAgentsPositionsScenery1()
+//Counter-based generator (two SplitMix64 rounds over the seed and the counter). The value depends only on them, so any node generates any agent independently
+unsigned long long CounterBasedRandom(unsigned long long seed, unsigned long long counter)
 {
-	vector<Vector2> agentsPositions;
-
-	//Generating agents at main node
-	if (myRank == 0)
+	unsigned long long z = seed;
+	for(int round = 0; round < 2; round++)
 	{
-		int h = GlobalArea.second.y() - GlobalArea.first.y();
-		int w = GlobalArea.second.x() - GlobalArea.first.x();
-		Vector2 zoneAMinPoint(0, 0);
-		Vector2 zoneAMaxPoint(0.3 * w, h);
-		pair<Vector2, Vector2> zoneA(zoneAMinPoint, zoneAMaxPoint);
+		z += 0x9E3779B97F4A7C15ULL + counter;
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		z = z ^ (z >> 31);
+	}
+	return z;
+}
 
-		int agentsInAZone = totalAgentsCount;
+float CounterBasedRandomBetween(unsigned long long counter, float LO, float HI)
+{
+	float unit = (CounterBasedRandom(generationSeed, counter) >> 40) / 16777216.0f; //24 high bits to [0, 1)
+	return LO + unit * (HI - LO);
+}
 
-		//Agents generating zones
-		Vector2 zomeAMinPoint = zoneA.first; 
-		Vector2 zomeAMaxPoint = zoneA.second;
+//Agents generating zones of the selected scenario and agents count in each of them. Global IDs are numbered through the zones in this order
+void ScenarioGenerationZones(vector<pair<Vector2, Vector2> > &zones, vector<long long> &zonesAgentsNum)
+{
+	int h = GlobalArea.second.y() - GlobalArea.first.y();
+	int w = GlobalArea.second.x() - GlobalArea.first.x();
 
-		srand(time(NULL));
-		//random agents in zone A
-		for (int i = 0; i < agentsInAZone; i++)
-		{
-			Vector2 agentPosition(GenerateRandomBetween(zomeAMinPoint.x() + 0.01, zomeAMaxPoint.x() - 0.01), GenerateRandomBetween(zomeAMinPoint.y() + 0.01, zomeAMaxPoint.y() - 0.01));
-			agentsPositions.push_back(agentPosition);
-		}
+	switch(SCENERY) {
+	case 1 :	//a long corridor
+		zones.push_back(pair<Vector2, Vector2>(Vector2(0, 0), Vector2(0.3 * w, h)));
+		zonesAgentsNum.push_back(totalAgentsCount);
+		break;
+	case 2 :	//collision of two crowds
+		zones.push_back(pair<Vector2, Vector2>(Vector2(0, 0), Vector2(0.3 * w, h)));
+		zonesAgentsNum.push_back(totalAgentsCount / 2);
+		zones.push_back(pair<Vector2, Vector2>(Vector2(0.7 * w, 0), Vector2(w, h)));
+		zonesAgentsNum.push_back(totalAgentsCount / 2);
+		break;
+	case 3 :	//passing through a static crowd
+		zones.push_back(pair<Vector2, Vector2>(Vector2(0.3 * w, 0), Vector2(0.65 * w, h)));
+		zonesAgentsNum.push_back(totalAgentsCount / 2);
+		zones.push_back(pair<Vector2, Vector2>(Vector2(0.7 * w, 0), Vector2(w, h)));
+		zonesAgentsNum.push_back(totalAgentsCount / 2);
+		break;
+	default:
+		MPI_Finalize();
+		exit(EXIT_FAILURE);
 	}
-
-	return agentsPositions;
 }
 
-vector<Vector2> GenerateRandomAgentsPositionsScenery2()
+//Position of the agent with given global ID inside the part of its generating cell
+Vector2 GenerateAgentPosition(long long globalID, const pair<Vector2, Vector2> &rect)
 {
-	vector<Vector2> agentsPositions;
+	return Vector2(CounterBasedRandomBetween(2 * globalID, rect.first.x(), rect.second.x()),
+		CounterBasedRandomBetween(2 * globalID + 1, rect.first.y(), rect.second.y()));
+}
 
-	//Generating agents at main node
-	if (myRank == 0)
+//Generating cells of the zone with IDs [firstID, firstID + agentsNum). Agents are kept 0.01 from the zone sides
+ZoneCells ZoneGenerationCells(const GridGeometry &grid, const pair<Vector2, Vector2> &zone, long long firstID, long long agentsNum)
+{
+	ZoneCells cells;
+	cells.zone = pair<Vector2, Vector2>(Vector2(zone.first.x() + 0.01, zone.first.y() + 0.01), Vector2(zone.second.x() - 0.01, zone.second.y() - 0.01));
+	cells.firstColumn = grid.Column(cells.zone.first.x());
+	cells.firstRow = grid.Row(cells.zone.first.y());
+	int lastColumn = grid.Column(cells.zone.second.x());
+	int lastRow = grid.Row(cells.zone.second.y());
+
+	cells.widthsBefore.assign(1, 0);
+	for(int column = cells.firstColumn; column <= lastColumn; column++)
 	{
-		int h = GlobalArea.second.y() - GlobalArea.first.y();
-		int w = GlobalArea.second.x() - GlobalArea.first.x();
-		Vector2 zoneAMinPoint(0, 0);
-		Vector2 zoneAMaxPoint(0.3 * w, h);
-		pair<Vector2, Vector2> zoneA(zoneAMinPoint, zoneAMaxPoint);
-
-		Vector2 zoneBMinPoint(0.7 * w, 0);
-		Vector2 zoneBMaxPoint(w, h);
-		pair<Vector2, Vector2> zoneB(zoneBMinPoint, zoneBMaxPoint);
-
-		int agentsInAZone = totalAgentsCount / 2;
-		int agentsInBZone = totalAgentsCount / 2;
-
-		//Agents generating zones
-		Vector2 zomeAMinPoint = zoneA.first; 
-		Vector2 zomeAMaxPoint = zoneA.second;
-		Vector2 zomeBMinPoint = zoneB.first; 
-		Vector2 zomeBMaxPoint = zoneB.second;
-
-		srand(time(NULL));
-		//random agents in zone A
-		for (int i = 0; i < agentsInAZone; i++)
-		{
-			Vector2 agentPosition(GenerateRandomBetween(zomeAMinPoint.x() + 0.01, zomeAMaxPoint.x() - 0.01), GenerateRandomBetween(zomeAMinPoint.y() + 0.01, zomeAMaxPoint.y() - 0.01));
-			agentsPositions.push_back(agentPosition);
-		}
+		float left = max(cells.zone.first.x(), grid.minX + column * grid.cellSize);
+		float right = min(cells.zone.second.x(), grid.minX + (column + 1) * grid.cellSize);
+		cells.widthsBefore.push_back(cells.widthsBefore.back() + max(0.f, right - left));
+	}
+	cells.heightsBefore.assign(1, 0);
+	for(int row = cells.firstRow; row <= lastRow; row++)
+	{
+		float bottom = max(cells.zone.first.y(), grid.minY + row * grid.cellSize);
+		float top = min(cells.zone.second.y(), grid.minY + (row + 1) * grid.cellSize);
+		cells.heightsBefore.push_back(cells.heightsBefore.back() + max(0.f, top - bottom));
+	}
 
-		//random agents in zone B
-		for (int i = 0; i < agentsInBZone; i++)
-		{
-			Vector2 agentPosition(GenerateRandomBetween(zomeBMinPoint.x() + 0.01, zomeBMaxPoint.x() - 0.01), GenerateRandomBetween(zomeBMinPoint.y() + 0.01, zomeBMaxPoint.y() - 0.01));
-			agentsPositions.push_back(agentPosition);
-		}
+	//Rows get their shares first, so the zone gets exactly its agents count
+	size_t rowsNum = cells.heightsBefore.size() - 1;
+	cells.rowsFirstIDs.resize(rowsNum + 1);
+	for(size_t row = 0; row <= rowsNum; row++)
+	{
+		cells.rowsFirstIDs[row] = firstID + (long long)floor(agentsNum * (cells.heightsBefore[row] / cells.heightsBefore[rowsNum]));
 	}
+	return cells;
+}
 
-	return agentsPositions;
+//First global ID of the cell. Column after the last one gives the first ID after the row
+long long ZoneCellFirstID(const ZoneCells &cells, int row, int column)
+{
+	int r = row - cells.firstRow;
+	size_t columnsNum = cells.widthsBefore.size() - 1;
+	long long rowAgentsNum = cells.rowsFirstIDs[r + 1] - cells.rowsFirstIDs[r];
+	return cells.rowsFirstIDs[r] + (long long)floor(rowAgentsNum * (cells.widthsBefore[column - cells.firstColumn] / cells.widthsBefore[columnsNum]));
 }
 
-vector<Vector2> GenerateRandomAgentsPositionsScenery3()
+//Part of the cell inside the zone
+pair<Vector2, Vector2> ZoneCellRect(const GridGeometry &grid, const ZoneCells &cells, int row, int column)
 {
-	vector<Vector2> agentsPositions;
+	return pair<Vector2, Vector2>(
+		Vector2(max(cells.zone.first.x(), grid.minX + column * grid.cellSize), max(cells.zone.first.y(), grid.minY + row * grid.cellSize)),
+		Vector2(min(cells.zone.second.x(), grid.minX + (column + 1) * grid.cellSize), min(cells.zone.second.y(), grid.minY + (row + 1) * grid.cellSize)));
+}
 
-	//Generating agents at main node
-	if (myRank == 0)
+//Cell of the zone global ID, empty cells have the same first ID as the next ones and are skipped
+void ZoneCellOfID(const ZoneCells &cells, long long globalID, int &row, int &column)
+{
+	row = cells.firstRow + (upper_bound(cells.rowsFirstIDs.begin(), cells.rowsFirstIDs.end(), globalID) - cells.rowsFirstIDs.begin()) - 1;
+	int firstColumn = cells.firstColumn;
+	int lastColumn = cells.firstColumn + cells.widthsBefore.size() - 2;
+	while(firstColumn < lastColumn)
 	{
-		int h = GlobalArea.second.y() - GlobalArea.first.y();
-		int w = GlobalArea.second.x() - GlobalArea.first.x();
-		Vector2 zoneAMinPoint(0.3 * w, 0);
-		Vector2 zoneAMaxPoint(0.65 * w, h);
-		pair<Vector2, Vector2> zoneA(zoneAMinPoint, zoneAMaxPoint);
-
-		Vector2 zoneBMinPoint(0.7 * w, 0);
-		Vector2 zoneBMaxPoint(w, h);
-		pair<Vector2, Vector2> zoneB(zoneBMinPoint, zoneBMaxPoint);
-
-		int agentsInAZone = totalAgentsCount / 2;
-		int agentsInBZone = totalAgentsCount / 2;
-
-		//Agents generating zones
-		Vector2 zomeAMinPoint = zoneA.first; 
-		Vector2 zomeAMaxPoint = zoneA.second;
-		Vector2 zomeBMinPoint = zoneB.first; 
-		Vector2 zomeBMaxPoint = zoneB.second;
-
-		srand(time(NULL));
-		//random agents in zone A
-		for (int i = 0; i < agentsInAZone; i++)
+		int middleColumn = (firstColumn + lastColumn + 1) / 2;
+		if(ZoneCellFirstID(cells, row, middleColumn) <= globalID)
 		{
-			Vector2 agentPosition(GenerateRandomBetween(zomeAMinPoint.x() + 0.01, zomeAMaxPoint.x() - 0.01), GenerateRandomBetween(zomeAMinPoint.y() + 0.01, zomeAMaxPoint.y() - 0.01));
-			agentsPositions.push_back(agentPosition);
+			firstColumn = middleColumn;
 		}
-
-		//random agents in zone B
-		for (int i = 0; i < agentsInBZone; i++)
+		else
 		{
-			Vector2 agentPosition(GenerateRandomBetween(zomeBMinPoint.x() + 0.01, zomeBMaxPoint.x() - 0.01), GenerateRandomBetween(zomeBMinPoint.y() + 0.01, zomeBMaxPoint.y() - 0.01));
-			agentsPositions.push_back(agentPosition);
+			lastColumn = middleColumn - 1;
 		}
 	}
-
-	return agentsPositions;
+	column = firstColumn;
 }
 
 void BcastingObstacles()
@@ -1012,84 +1610,330 @@ void BcastingObstacles()
 		delete[] obstacleArray;
 		//cout << "Rank: " << myRank << " delete operation performed." << endl;
 
-		for(int i = 0; i < obstacles.size(); i++)
+		AddingAreaObstacles();
+		//cout << "Rank: " << myRank << " all obstacles proceesed." << endl;
+	}
+}
+
+//Simulator of a worker gets only obstacles which bounding boxes cross its area extended by adjacent area width.
+//Obstacles near new areas are added after rebalancing, obstacles tree is rebuilt only if something was added
+void AddingAreaObstacles()
+{
+	if(myRank == 0 || myRank >= modelingAreas.size() + 1)
+	{
+		return;
+	}
+
+	if(obstaclesBounds.size() != 4 * obstacles.size())
+	{
+		obstaclesBounds.resize(4 * obstacles.size());
+		for(size_t i = 0; i < obstacles.size(); i++)
+		{
+			float* bounds = &obstaclesBounds[4 * i];
+			bounds[0] = bounds[2] = obstacles[i].empty() ? 0 : obstacles[i][0].x();
+			bounds[1] = bounds[3] = obstacles[i].empty() ? 0 : obstacles[i][0].y();
+			for(size_t j = 1; j < obstacles[i].size(); j++)
+			{
+				bounds[0] = min(bounds[0], obstacles[i][j].x());
+				bounds[1] = min(bounds[1], obstacles[i][j].y());
+				bounds[2] = max(bounds[2], obstacles[i][j].x());
+				bounds[3] = max(bounds[3], obstacles[i][j].y());
+			}
+		}
+		obstaclesAdded.assign(obstacles.size(), 0);
+	}
+
+	const pair<Vector2, Vector2> &myArea = modelingAreas[myRank];
+	float minX = myArea.first.x() - adjacentAreaWidth;
+	float minY = myArea.first.y() - adjacentAreaWidth;
+	float maxX = myArea.second.x() + adjacentAreaWidth;
+	float maxY = myArea.second.y() + adjacentAreaWidth;
+	int addedNum = 0;
+	int totalAddedNum = 0;
+	for(size_t i = 0; i < obstacles.size(); i++)
+	{
+		const float* bounds = &obstaclesBounds[4 * i];
+		if(!obstaclesAdded[i] && bounds[0] <= maxX && minX <= bounds[2] && bounds[1] <= maxY && minY <= bounds[3])
 		{
 			simulator->addObstacle(obstacles[i]);
+			obstaclesAdded[i] = 1;
+			addedNum++;
 		}
+		totalAddedNum += obstaclesAdded[i];
+	}
+
+	if(addedNum > 0)
+	{
 		simulator->processObstacles();
-		//cout << "Rank: " << myRank << " all obstacles proceesed." << endl;
 	}
+	printf ("rank: %d obstacles in simulator: %d of %d\n", myRank, totalAddedNum, (int)obstacles.size());
 }
 
-void BroadcastingGeneratedAgents(vector<Vector2> agentsPositions)
+//Every worker generates only agents which fall into its own area, main node gathers agents IDs pairs at once
+void GeneratingAgents()
 {
-	if(myRank == 0)
+	vector<pair<Vector2, Vector2> > zones;
+	vector<long long> zonesAgentsNum;
+	ScenarioGenerationZones(zones, zonesAgentsNum);
+
+	//Global ID is the index of generated agent, so it doesnt depend on the nodes count and is never reused
+	scenarioAgentsNum = 0;
+	for(size_t z = 0; z < zones.size(); z++)
+	{
+		scenarioAgentsNum += zonesAgentsNum[z];
+	}
+	totalAgentsIDs = scenarioAgentsNum;
+
+	vector<ZoneCells> zonesCells;
+	long long zoneFirstID = 0;
+	for(size_t z = 0; z < zones.size(); z++)
+	{
+		zonesCells.push_back(ZoneGenerationCells(ownersGrid, zones[z], zoneFirstID, zonesAgentsNum[z]));
+		zoneFirstID += zonesAgentsNum[z];
+	}
+
+	//Workers generate only agents of the cells crossing their areas
+	vector<long long> ids; //pairs: agent ID on node, global ID
+	if(myRank != 0 && myRank < modelingAreas.size() + 1)
+	{
+		pair<Vector2, Vector2> myArea(modelingAreas[myRank].first, modelingAreas[myRank].second);
+		for(size_t z = 0; z < zones.size(); z++)
+		{
+			const ZoneCells &cells = zonesCells[z];
+			int firstColumn = max(cells.firstColumn, ownersGrid.Column(myArea.first.x()));
+			int lastColumn = min(cells.firstColumn + (int)cells.widthsBefore.size() - 2, ownersGrid.Column(myArea.second.x()));
+			int firstRow = max(cells.firstRow, ownersGrid.Row(myArea.first.y()));
+			int lastRow = min(cells.firstRow + (int)cells.heightsBefore.size() - 2, ownersGrid.Row(myArea.second.y()));
+			for(int row = firstRow; row <= lastRow; row++)
+			{
+				for(int column = firstColumn; column <= lastColumn; column++)
+				{
+					int cell = row * ownersGrid.columns + column;
+					if(find(ownersGrid.owners.begin() + ownersGrid.ownersStart[cell], ownersGrid.owners.begin() + ownersGrid.ownersStart[cell + 1], myRank)
+						== ownersGrid.owners.begin() + ownersGrid.ownersStart[cell + 1])
+					{
+						continue;
+					}
+
+					pair<Vector2, Vector2> rect = ZoneCellRect(ownersGrid, cells, row, column);
+					long long lastID = ZoneCellFirstID(cells, row, column + 1);
+					for(long long globalID = ZoneCellFirstID(cells, row, column); globalID < lastID; globalID++)
+					{
+						Vector2 agentPosition = GenerateAgentPosition(globalID, rect);
+						bool ownPosition = (PARTITIONING == 2) ? FindAreaByPoint(agentPosition.x(), agentPosition.y()) == myRank
+							: agentPosition.x() >= myArea.first.x() && agentPosition.x() < myArea.second.x()
+							&& agentPosition.y() >= myArea.first.y() && agentPosition.y() < myArea.second.y();
+						if(ownPosition)
+						{
+							long long newAgentID = simulator->addAgent(agentPosition);
+							LocalAgentsGlobalIDs[newAgentID] = globalID;
+							ids.push_back(newAgentID);
+							ids.push_back(globalID);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	if(!mainNodeKeepsIDs)
 	{
-		for (int i = 0; i < agentsPositions.size(); i++)
+		long long addedAgentsNum = 0;
+		long long localAgentsNum = ids.size() / 2;
+		MPI_Reduce(&localAgentsNum, &addedAgentsNum, 1, MPI_LONG_LONG_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+		if(myRank == 0 && addedAgentsNum != scenarioAgentsNum)
+		{
+			cout << "rank: " << myRank << " " << scenarioAgentsNum - addedAgentsNum << " generated agents are outside of modeling areas and werent added" << endl;
+		}
+	}
+	else
+	{
+		int idsSize = ids.size();
+		vector<int> idsSizes(commSize, 0);
+		MPI_Gather(&idsSize, 1, MPI_INT, &idsSizes[0], 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+		vector<int> displacements(commSize, 0);
+		vector<long long> allIDs;
+		if(myRank == 0)
 		{
-			int destinationNode = 0;
-			bool IsPOintAdded = false;
-			for(map<int, pair<Vector2, Vector2> >::iterator it = modelingAreas.begin(); it != modelingAreas.end(); ++it)
+			for(int i = 1; i < commSize; i++)
 			{
-				if(agentsPositions[i].x() >= it->second.first.x() && agentsPositions[i].x() < it->second.second.x())
+				displacements[i] = displacements[i - 1] + idsSizes[i - 1];
+			}
+			allIDs.resize(displacements[commSize - 1] + idsSizes[commSize - 1] + 1);
+		}
+		MPI_Gatherv(ids.empty() ? NULL : &ids[0], idsSize, MPI_LONG_LONG_INT,
+			myRank == 0 ? &allIDs[0] : NULL, &idsSizes[0], &displacements[0], MPI_LONG_LONG_INT, 0, MPI_COMM_WORLD);
+
+		if(myRank == 0)
+		{
+			AgentsNodeIDs.assign(scenarioAgentsNum, -1);
+			AgentsLocalIDs.assign(scenarioAgentsNum, -1);
+			AgentsDeleted.assign(scenarioAgentsNum, 0);
+			if(mainNodeKeepsPositions)
+			{
+				AgentsPositions.assign(scenarioAgentsNum, Vector2(INT_MIN, INT_MIN));
+			}
+			NodesAgentsTables.assign(commSize, AgentsIDTable());
+			long long addedAgentsNum = 0;
+			for(int node = 1; node < commSize; node++)
+			{
+				for(int i = displacements[node]; i < displacements[node] + idsSizes[node]; i += 2)
 				{
-					if(agentsPositions[i].y() >= it->second.first.y() && agentsPositions[i].y() < it->second.second.y())
+					long long newAgentID = allIDs[i];
+					long long globalID = allIDs[i + 1];
+
+					AgentsNodeIDs[globalID] = node;
+					AgentsLocalIDs[globalID] = newAgentID;
+					NodesAgentsTables[node].Insert(newAgentID, globalID);
+					if(mainNodeKeepsPositions)
 					{
-						destinationNode = it->first;
-						MPI_Bcast(&destinationNode, 1, MPI_INT, 0, MPI_COMM_WORLD);
-						//cout << "rank: " << myRank << " Sending to: " << destinationNode << endl;
-
-						//Sending agent position
-						float x = agentsPositions[i].x();
-						float y = agentsPositions[i].y();
-						MPI_Send(&x, 1, MPI_INT, destinationNode, 0, MPI_COMM_WORLD);
-						MPI_Send(&y, 1, MPI_INT, destinationNode, 0, MPI_COMM_WORLD);
-						long long newAgentID = 0;
-						//cout << "rank: " << myRank << " Position " << x << ":" << y << " to " << destinationNode << " sended."<< endl;
-						//cout << "rank: " << myRank << " Receiving new ID from: " << destinationNode << endl;
-						MPI_Recv(&newAgentID, 1, MPI_LONG_LONG_INT, destinationNode, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE); //Receiving new agent ID
-						//cout << "rank: " << myRank << " new agent id received: " << newAgentID << endl;
-
-						AgentsIDMap[totalAgentsIDs] = AgentOnNodeInfo(destinationNode, newAgentID);
-						NodesAgentsMap[destinationNode][newAgentID] = totalAgentsIDs;
-
-						AgentsPositions[totalAgentsIDs] = Vector2(x, y);
-						totalAgentsIDs++;
-						//cout << "rank: " << myRank << " Position " << x << ":" << y << " Global ID: "<< totalAgentsIDs - 1  << " Node: "<< AgentsIDMap[totalAgentsIDs - 1]._nodeID << " ID: " << AgentsIDMap[totalAgentsIDs - 1]._agentID << endl;
-						IsPOintAdded = true;
+						//Main node regenerates the position from the global ID instead of receiving it
+						size_t z = 0;
+						while(globalID >= zonesCells[z].rowsFirstIDs.back())
+						{
+							z++;
+						}
+						int row = 0;
+						int column = 0;
+						ZoneCellOfID(zonesCells[z], globalID, row, column);
+						AgentsPositions[globalID] = GenerateAgentPosition(globalID, ZoneCellRect(ownersGrid, zonesCells[z], row, column));
 					}
+					addedAgentsNum++;
 				}
 			}
-			if (!IsPOintAdded)
+
+			if(addedAgentsNum != scenarioAgentsNum)
 			{
-				cout << "rank: " << myRank << " Position: " << agentsPositions[i].x() << " : " << agentsPositions[i].y() << " wasnt added" << endl;
+				cout << "rank: " << myRank << " " << scenarioAgentsNum - addedAgentsNum << " generated agents are outside of modeling areas and werent added" << endl;
 			}
 		}
-		int negativeValueToStopListening = -1;
-		MPI_Bcast(&negativeValueToStopListening, 1, MPI_INT, 0, MPI_COMM_WORLD);
 	}
-	else
+	CollectingLocalAgents();
+}
+
+//Agents without global IDs are phantoms of other nodes and arent collected
+void CollectingLocalAgents()
+{
+	localAgents.agents.clear();
+	localAgents.ids.clear();
+	localAgents.globalIDs.clear();
+	localAgents.xs.clear();
+	localAgents.ys.clear();
+	if(myRank == 0 || myRank >= modelingAreas.size() + 1)
 	{
-		int receivedIndex = 0;
-		do
+		return;
+	}
+
+	vector<Agent*> aliveAgents = simulator->getAliveAgents();
+	MPIAgent agent;
+	for(size_t ag = 0; ag < aliveAgents.size(); ag++)
+	{
+		agent.agent = aliveAgents[ag];
+		long long agentID = agent.ID();
+		map<long long, long long>::iterator globalIt = LocalAgentsGlobalIDs.find(agentID);
+		if(globalIt == LocalAgentsGlobalIDs.end())
+		{
+			continue;
+		}
+
+		Vector2 position = agent.Position();
+		localAgents.agents.push_back(aliveAgents[ag]);
+		localAgents.ids.push_back(agentID);
+		localAgents.globalIDs.push_back(globalIt->second);
+		localAgents.xs.push_back(position.x());
+		localAgents.ys.push_back(position.y());
+	}
+}
+
+//Preferred velocity of an agent according to the goals of the selected scenario. Depends only on replicated data, so it gives the same result on the main node and on workers
+Vector2 ScenarioPreferredVelocity(long long globalID, const Vector2 &position)
+{
+	float xVel = 0;
+	float yVel = 0;
+	//int h = GlobalArea.second.y() - GlobalArea.first.y();
+	int w = GlobalArea.second.x() - GlobalArea.first.x();
+
+	switch(SCENERY) {
+	case 1: 					
 		{
-			MPI_Bcast(&receivedIndex, 1, MPI_INT, 0, MPI_COMM_WORLD);
-			if (receivedIndex == myRank)
+#pragma region Scenery one, long corridor
+			if (position.x() <= 0.98 * w)
 			{
-				//cout << "rank: " << myRank << " Receiving agent position" << endl;
-				float x, y;
-				MPI_Recv(&x, 1, MPI_FLOAT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-				MPI_Recv(&y, 1, MPI_FLOAT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-				//cout << "rank: " << myRank << " Position " << x << ":" << y << " received." << endl;
-				//if(x < )
-				long long agentID = simulator->addAgent(Vector2(x, y));
-				//cout << "rank: " << myRank << " new agend added to simulator. ID: " << agentID << endl;
-				MPI_Send(&agentID, 1, MPI_LONG_LONG_INT, 0, 0, MPI_COMM_WORLD); //Sending back new agent ID
-				//cout << "rank: " << myRank << " ID of new agent sent to main node." << endl;
+				xVel = 1;
+				yVel = 0;
 			}
-		} 
-		while (receivedIndex > 0);
+			else //if they reached their destination
+			{
+				xVel = 0;
+				yVel = 0;
+			}
+#pragma endregion Scenery one, long corridor
+		}
+		break;
+	case 2: 					
+		{
+#pragma region Scenery two, crowds collision
+			if (globalID < scenarioAgentsNum / 2) //Agents from zone A
+			{
+				if (position.x() <= 0.98 * w)
+				{
+					xVel = 1;
+					yVel = 0;
+				}
+				else //if they reached their destination
+				{
+					xVel = 0;
+					yVel = 0;
+				}
+			}
+			else //Agents from zone B
+			{
+				if (position.x() >= 0.02 * w)
+				{
+					xVel = -1;
+					yVel = 0;
+				}
+				else //if they reached their destination
+				{
+					xVel = 0;
+					yVel = 0;
+				}
+			}
+#pragma endregion Scenery two, crowds collision		
+		}
+		break;
+	case 3: 					
+		{
+#pragma region Scenery three, passing throw static crowd
+			if (globalID < scenarioAgentsNum / 2) //Agents from zone A
+			{
+				xVel = 0;
+				yVel = 0;
+			}
+			else //Agents from zone B
+			{
+				if (position.x() >= 0.02 * w)
+				{
+					xVel = -1;
+					yVel = 0;
+				}
+				else //if they reached their destination
+				{
+					xVel = 0;
+					yVel = 0;
+				}
+			}
+#pragma endregion Scenery three, passing throw static crowd
+		}
+		break;
+	default:
+		MPI_Finalize();
+		exit(EXIT_FAILURE);		
+
 	}
+
+	return Vector2(xVel, yVel);
 }
 
 void SendNewVelocities()
@@ -1098,7 +1942,6 @@ void SendNewVelocities()
 	long long agentId = -1;
 	float xVel = 0;
 	float yVel = 0;
-	int agNum = AgentsIDMap.size();
 	//MPI_Request req;
 	//cout << myRank << "start of SendNewVelocities" << endl;
 	try
@@ -1107,25 +1950,28 @@ void SendNewVelocities()
 		{
 			//int velocitiesSendingStartTime = clock();
 
-			//int h = GlobalArea.second.y() - GlobalArea.first.y();
-			int w = GlobalArea.second.x() - GlobalArea.first.x();
-
 			size_t agentWithVelSize = sizeof(long long) + sizeof(float) + sizeof(float);
 			//for(int i = 0; i < modelingAreas.size(); i++)
 			//for(map<int, pair<Vector2, Vector2> >::iterator it = modelingAreas.begin(); it != modelingAreas.end(); ++it)
-			for (map<int, map<long long, long long> >::iterator ndIter = NodesAgentsMap.begin(); ndIter != NodesAgentsMap.end(); ++ndIter)
+			for (int node = 1; node < NodesAgentsTables.size(); node++)
 			{
+				const AgentsIDTable &nodeAgents = NodesAgentsTables[node];
+				if (nodeAgents.Size() == 0)
+				{
+					continue;
+				}
+
 				vector<long long> agentsToSend;
 				int position = 0;
-				destinationNode = ndIter->first;
+				destinationNode = node;
 				MPI_Bcast(&destinationNode, 1, MPI_INT, 0, MPI_COMM_WORLD);
 				//MPI_Ibcast(&destinationNode, 1, MPI_INT, 0, MPI_COMM_WORLD, &req);
 
-				for (map<long long, long long>::iterator idIter = ndIter->second.begin(); idIter != ndIter->second.end(); ++idIter)
+				for (size_t slot = 0; slot < nodeAgents.Capacity(); slot++)
 				{
-					if (!AgentsIDMap[idIter->second].isDeleted)
+					if (nodeAgents.KeyAt(slot) >= 0 && !AgentsDeleted[nodeAgents.ValueAt(slot)])
 					{
-						agentsToSend.push_back(idIter->second);
+						agentsToSend.push_back(nodeAgents.ValueAt(slot));
 					}
 				}
 
@@ -1138,158 +1984,11 @@ void SendNewVelocities()
 
 				for (int ag = 0; ag < agentsToSend.size(); ag++) //packing agents data
 				{
-					agentId = AgentsIDMap[agentsToSend[ag]]._agentID;
-
-					switch(SCENERY) {
-					case 1: 					
-						{
-#pragma region Scenery one, long corridor
-							if (AgentsPositions[agentsToSend[ag]].x() <= 0.98 * w)
-							{
-								xVel = 1;
-								yVel = 0;
-							}
-							else //if they reached their destination
-							{
-								xVel = 0;
-								yVel = 0;
-							}
-#pragma endregion Scenery one, long corridor
-						}
-						break;
-					case 2: 					
-						{
-#pragma region Scenery two, crowds collision
-							if (agentsToSend[ag] < agNum / 2) //Agents from zone A NOT WORKING IN COMMON CASE
-							{
-								if (AgentsPositions[agentsToSend[ag]].x() <= 0.98 * w)
-								{
-									xVel = 1;
-									yVel = 0;
-								}
-								else //if they reached their destination
-								{
-									xVel = 0;
-									yVel = 0;
-								}
-							}
-							else //Agents from zone B
-							{
-								if (AgentsPositions[agentsToSend[ag]].x() >= 0.02 * w)
-								{
-									xVel = -1;
-									yVel = 0;
-								}
-								else //if they reached their destination
-								{
-									xVel = 0;
-									yVel = 0;
-								}
-							}
-#pragma endregion Scenery two, crowds collision		
-						}
-						break;
-					case 3: 					
-						{
-#pragma region Scenery three, passing throw static crowd
-							if (agentsToSend[ag] < agNum / 2) //Agents from zone A NOT WORKING IN COMMON CASE
-							{
-								xVel = 0;
-								yVel = 0;
-							}
-							else //Agents from zone B
-							{
-								if (AgentsPositions[agentsToSend[ag]].x() >= 0.02 * w)
-								{
-									xVel = -1;
-									yVel = 0;
-								}
-								else //if they reached their destination
-								{
-									xVel = 0;
-									yVel = 0;
-								}
-							}
-#pragma endregion Scenery three, passing throw static crowd
-						}
-						break;
-					default:
-						MPI_Finalize();
-						exit(EXIT_FAILURE);		
-
-					}
+					agentId = AgentsLocalIDs[agentsToSend[ag]];
 
-					//if(SCENERY == "SCENERY1")
-					//{
-					//	#pragma region Scenery one, long corridor
-					//	if (AgentsPositions[agentsToSend[ag]].x() <= 0.98 * w)
-					//	{
-					//		xVel = 1;
-					//		yVel = 0;
-					//	}
-					//	else //if they reached their destination
-					//	{
-					//		xVel = 0;
-					//		yVel = 0;
-					//	}
-					//	#pragma endregion Scenery one, long corridor
-					//}
-
-					//if(SCENERY == "SCENERY2")
-					//{
-					//	#pragma region Scenery two, crowds collision
-					//	if (agentsToSend[ag] < agNum / 2) //Agents from zone A NOT WORKING IN COMMON CASE
-					//	{
-					//		if (AgentsPositions[agentsToSend[ag]].x() <= 0.98 * w)
-					//		{
-					//			xVel = 1;
-					//			yVel = 0;
-					//		}
-					//		else //if they reached their destination
-					//		{
-					//			xVel = 0;
-					//			yVel = 0;
-					//		}
-					//	}
-					//	else //Agents from zone B
-					//	{
-					//		if (AgentsPositions[agentsToSend[ag]].x() >= 0.02 * w)
-					//		{
-					//			xVel = -1;
-					//			yVel = 0;
-					//		}
-					//		else //if they reached their destination
-					//		{
-					//			xVel = 0;
-					//			yVel = 0;
-					//		}
-					//	}
-					//	#pragma endregion Scenery two, crowds collision		
-					//}
-
-					//if(SCENERY == "SCENERY2")
-					//{
-					//	#pragma region Scenery three, passing throw static crowd
-					//	if (agentsToSend[ag] < agNum / 2) //Agents from zone A NOT WORKING IN COMMON CASE
-					//	{
-					//		xVel = 0;
-					//		yVel = 0;
-					//	}
-					//	else //Agents from zone B
-					//	{
-					//		if (AgentsPositions[agentsToSend[ag]].x() >= 0.02 * w)
-					//		{
-					//			xVel = -1;
-					//			yVel = 0;
-					//		}
-					//		else //if they reached their destination
-					//		{
-					//			xVel = 0;
-					//			yVel = 0;
-					//		}
-					//	}
-					//	#pragma endregion Scenery three, passing throw static crowd
-					//}
+					Vector2 prefVelocity = ScenarioPreferredVelocity(agentsToSend[ag], AgentsPositions[agentsToSend[ag]]);
+					xVel = prefVelocity.x();
+					yVel = prefVelocity.y();
 
 					//cout << "Agent packing ID: " << agentId << " xvel: " << xVel << " yVel: " << yVel << endl; 
 					MPI_Pack(&agentId, 1, MPI_LONG_LONG_INT, buffer, buffSize, &position, MPI_COMM_WORLD);
@@ -1375,204 +2074,505 @@ void SendNewVelocities()
 	//cout << myRank << "end of SendNewVelocities" << endl;
 }
 
-bool IsPointAdjacentToArea(Vector2 position, pair<Vector2, Vector2> area, int adjacentAreaWidth)
+//Workers set preferred velocities of their agents without main node participation
+void ComputeNewVelocitiesLocally()
 {
-	if(	area.first.x() - adjacentAreaWidth		<= position.x() 
-		&& area.second.x() + adjacentAreaWidth	>= position.x()
-		&& area.first.y() - adjacentAreaWidth	<= position.y()
-		&& area.second.y() + adjacentAreaWidth	>= position.y())
+	try
+	{
+		if(myRank != 0 && myRank < modelingAreas.size() + 1)
+		{
+			for(size_t ag = 0; ag < localAgents.ids.size(); ag++)
+			{
+				simulator->setAgentPrefVelocity(localAgents.ids[ag], ScenarioPreferredVelocity(localAgents.globalIDs[ag], Vector2(localAgents.xs[ag], localAgents.ys[ag])));
+			}
+		}
+	}
+	catch(const std::runtime_error& re)
+	{
+	    // speciffic handling for runtime_error
+		std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
+	    std::cerr << "Runtime error: " << re.what() << std::endl;
+		PRINT_STACK_TRACE
+	}
+	catch(const std::exception& ex)
+	{
+	    // speciffic handling for all exceptions extending std::exception, except
+	    // std::runtime_error which is handled explicitly
+		std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
+	    std::cerr << "Error occurred: " << ex.what() << std::endl;
+		PRINT_STACK_TRACE
+	}
+	catch(...)
 	{
-		//cout << "++++Point " << position.x() << " " << position.y() << " is adjacent to " << area.first.x() << " " << area.first.y() << " " << area.second.x() << " " << area.second.y() << endl;  
-		return true;	
+		std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
+		PRINT_STACK_TRACE
+		MPI_Finalize();
+		exit(EXIT_FAILURE);
 	}
-	//cout << "----Point " << position.x() << " " << position.y() << " is NOT adjacent to " << area.first.x() << " " << area.first.y() << " " << area.second.x() << " " << area.second.y() << endl;  
-	return false;
 }
 
+//Sends agents placed in adjacent areas to neighbor areas and adds phantoms received from them to the simulation
 void ExchangingByPhantoms()
 {
-	//cout << myRank << "start of ExchangingByPhantoms" << endl;
 	try
 	{
 		if(myRank < modelingAreas.size() + 1 && myRank != 0)
 		{
-			//cout << myRank << " In ExchangingByPhantoms "  << modelingAreas[myRank].first.x() << " " << modelingAreas[myRank].first.y() << " " << modelingAreas[myRank].second.x() << " " << modelingAreas[myRank].second.y() << endl;
-			//int ExchangingByPhantomsStartTime = clock();
-			map<int, vector<unsigned char*> > agentsToShift;
-			for(int i = 1; i < modelingAreas.size() + 1; i++) //Initializing map
+			size_t neighborsNum = neighborAreas.size();
+			vector<vector<unsigned char*> > agentsToShift(neighborsNum); //Serialized agents for each neighbor area
+			vector<int> recipients;
+			for(size_t ag = 0; ag < localAgents.ids.size(); ag++)
 			{
-				vector<unsigned char*> serializedAgentsVector;
-				agentsToShift[i] = serializedAgentsVector; 
+				FindPhantomRecipients(localAgents.xs[ag], localAgents.ys[ag], recipients); //empty for agents far from areas borders
+				for(size_t i = 0; i < recipients.size(); i++)
+				{
+					int nb = neighborsIndices[recipients[i]];
+					if(nb >= 0)
+					{
+						agentsToShift[nb].push_back(localAgents.agents[ag]->Serialize());
+					}
+				}
 			}
-			float x;
-			float y;
-			//vector<size_t> aliveAgents = simulator->getAliveAgentIdsList();
-			std::map<size_t, Agent*> agents = simulator->getAllAgents();
 
-			for(std::map<size_t, Agent*>::iterator it = agents.begin(); it != agents.end(); ++it)
+			//Buffers sizes are exchanged first, zero size means there are no phantoms for the neighbor
+			vector<int> sendSizes(neighborsNum, 0);
+			vector<int> recvSizes(neighborsNum, 0);
+			vector<unsigned char*> sendBuffers(neighborsNum, (unsigned char*)NULL);
+			vector<unsigned char*> recvBuffers(neighborsNum, (unsigned char*)NULL);
+			vector<MPI_Request> sizeRequests;
+			vector<MPI_Request> dataRequests;
+			int position = 0;
+			int agentSize = 0;
+
+			for(size_t nb = 0; nb < neighborsNum; nb++)
 			{
-				MPIAgent agent = MPIAgent(it->second);
-				x = agent.Position().x();
-				y = agent.Position().y();
+				MPI_Request req;
+				MPI_Irecv(&recvSizes[nb], 1, MPI_INT, neighborAreas[nb], 100, MPI_COMM_WORLD, &req);
+				sizeRequests.push_back(req);
+			}
 
-				pair<Vector2, Vector2> myArea(modelingAreas[myRank].first, modelingAreas[myRank].second); //= make_pair(modelingAreas[myRank].first, modelingAreas[myRank].second);
+			for(size_t nb = 0; nb < neighborsNum; nb++)
+			{
+				int buffSize = 0;
+				for(size_t i = 0; i < agentsToShift[nb].size(); i++)
+				{
+					memcpy(&agentSize, agentsToShift[nb][i], sizeof(int));
+					buffSize += sizeof(int) + agentSize;
+				}
 
-				if(		x >= myArea.first.x()	&& x <= myArea.first.x() + adjacentAreaWidth 
-					||	x <= myArea.second.x()	&& x >= myArea.second.x() - adjacentAreaWidth
-					||	y >= myArea.first.y()	&& y <= myArea.first.y() + adjacentAreaWidth 
-					||	y <= myArea.second.y()	&& y >= myArea.second.y() - adjacentAreaWidth ) //checking for placing in adjacent area
+				if(buffSize > 0)
 				{
-					//cout << " Agent with coords x:" << x << " y:" << y << "is in adjacent area of "  << myArea.first.x() << " " << myArea.first.y() << " " << myArea.second.x()  << " " << myArea.second.y() << endl;
-					for(map<int, pair<Vector2, Vector2> >::iterator ar = modelingAreas.begin(); ar != modelingAreas.end(); ++ar)
+					sendBuffers[nb] = new unsigned char[buffSize];
+					position = 0;
+					for(size_t i = 0; i < agentsToShift[nb].size(); i++)
 					{
-						if(ar->first != myRank)
-						{
-							if(IsPointAdjacentToArea(agent.Position(), ar->second, adjacentAreaWidth))
-							{
-								unsigned char* serializedAgent = agent.SerializeAgent();
-								agentsToShift[ar->first].push_back(serializedAgent);
-								//cout << " Agent with coords x:" << x << " y:" << y << "is in adjacent area to area " << ar->first << endl;
-							}
-						}
+						memcpy(&agentSize, agentsToShift[nb][i], sizeof(int));
+						MPI_Pack(&agentSize, 1, MPI_INT, sendBuffers[nb], buffSize, &position, MPI_COMM_WORLD);
+						MPI_Pack(agentsToShift[nb][i], agentSize, MPI_UNSIGNED_CHAR, sendBuffers[nb], buffSize, &position, MPI_COMM_WORLD);
+						delete[] agentsToShift[nb][i];
 					}
+					sendSizes[nb] = position;
+				}
+
+				MPI_Request req;
+				MPI_Isend(&sendSizes[nb], 1, MPI_INT, neighborAreas[nb], 100, MPI_COMM_WORLD, &req);
+				sizeRequests.push_back(req);
+				if(sendSizes[nb] > 0)
+				{
+					MPI_Isend(sendBuffers[nb], sendSizes[nb], MPI_PACKED, neighborAreas[nb], 101, MPI_COMM_WORLD, &req);
+					dataRequests.push_back(req);
 				}
 			}
 
-			//cout << myRank << " Alive agents count " << aliveAgents.size() << endl;
-			//for(int i = 0; i < aliveAgents.size(); i++)
-			//{
-			//	MPIAgent agent = MPIAgent(simulator->getAgent(aliveAgents[i]));
-			//	x = agent.Position().x();
-			//	y = agent.Position().y();
-
-			//	pair<Vector2, Vector2> myArea(modelingAreas[myRank].first, modelingAreas[myRank].second); //= make_pair(modelingAreas[myRank].first, modelingAreas[myRank].second);
-
-			//	if(		x >= myArea.first.x()	&& x <= myArea.first.x() + adjacentAreaWidth 
-			//		||	x <= myArea.second.x()	&& x >= myArea.second.x() - adjacentAreaWidth
-			//		||	y >= myArea.first.y()	&& y <= myArea.first.y() + adjacentAreaWidth 
-			//		||	y <= myArea.second.y()	&& y >= myArea.second.y() - adjacentAreaWidth ) //checking for placing in adjacent area
-			//	{
-			//		//cout << " Agent with coords x:" << x << " y:" << y << "is in adjacent area of "  << myArea.first.x() << " " << myArea.first.y() << " " << myArea.second.x()  << " " << myArea.second.y() << endl;
-			//		for(map<int, pair<Vector2, Vector2> >::iterator ar = modelingAreas.begin(); ar != modelingAreas.end(); ++ar)
-			//		{
-			//			if(ar->first != myRank)
-			//			{
-			//				if(IsPointAdjacentToArea(agent.Position(), ar->second, adjacentAreaWidth))
-			//				{
-			//					unsigned char* serializedAgent = agent.SerializeAgent();
-			//					agentsToShift[ar->first].push_back(serializedAgent);
-			//					//cout << " Agent with coords x:" << x << " y:" << y << "is in adjacent area to area " << ar->first << endl;
-			//				}
-			//			}
-			//		}
-			//	}
-			//}
+			if(!sizeRequests.empty())
+			{
+				MPI_Waitall(sizeRequests.size(), &sizeRequests[0], MPI_STATUSES_IGNORE);
+			}
 
-			int buffSize = 0;
-			unsigned char* buffer;
-			MPI_Status stat;
-			vector<unsigned char*> receivedAgents;
-			int position = 0;
-			int agentSize = 0;
+			for(size_t nb = 0; nb < neighborsNum; nb++)
+			{
+				if(recvSizes[nb] > 0)
+				{
+					MPI_Request req;
+					recvBuffers[nb] = new unsigned char[recvSizes[nb]];
+					MPI_Irecv(recvBuffers[nb], recvSizes[nb], MPI_PACKED, neighborAreas[nb], 101, MPI_COMM_WORLD, &req);
+					dataRequests.push_back(req);
+				}
+			}
+
+			if(!dataRequests.empty())
+			{
+				MPI_Waitall(dataRequests.size(), &dataRequests[0], MPI_STATUSES_IGNORE);
+			}
 
-			for(map<int, pair<Vector2, Vector2> >::iterator nd = modelingAreas.begin(); nd != modelingAreas.end(); ++nd)
+			//unpacking and adding phantoms to the simulation
+			for(size_t nb = 0; nb < neighborsNum; nb++)
 			{
-				//cout << "Current shifting iter: " << nd->first << endl;
-				buffSize = 0;
-				if(myRank == nd->first) //Receiving
+				delete[] sendBuffers[nb];
+				if(recvSizes[nb] > 0)
 				{
-					//cout << myRank << " Im receiving phantoms " << endl;
-					for(int senderNodes = 0; senderNodes < modelingAreas.size() - 1; senderNodes++ )
+					position = 0;
+					do
 					{
-						MPI_Recv(&buffSize, 1, MPI_INT, MPI_ANY_SOURCE, 100, MPI_COMM_WORLD, &stat);
-						int source = stat.MPI_SOURCE;
-						//cout << "Receiving from " << source << endl;
-						//cout << myRank << " In receiving from: " << source << " Iter: " << senderNodes << " Buffer size: " << buffSize << endl;
-						if(buffSize > 0)
-						{
-							position = 0;
-							buffer = new unsigned char[buffSize];
-							MPI_Recv(buffer, buffSize, MPI_UNSIGNED_CHAR, source, 100, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-							//cout << " Buffer received" << endl;
-
-							//unpacking and puting to receivedAgents
-							do
-							{
-								agentSize = 0;
-								MPI_Unpack(buffer, buffSize, &position, &agentSize, 1, MPI_INT, MPI_COMM_WORLD);
-								unsigned char* serializedAgent = new unsigned char[agentSize];
-								MPI_Unpack(buffer, buffSize, &position, serializedAgent, agentSize, MPI_UNSIGNED_CHAR, MPI_COMM_WORLD);
-								receivedAgents.push_back(serializedAgent);
-								//cout << " Agent unpacked: " << position << " " << buffSize << endl;
-							}
-							while (position < buffSize);
-							delete[] buffer;
-							//cout << " receivedAgents count " << receivedAgents.size() << endl;
-						}
-						//else
-						//{
-						//	cout << " received zero " << endl;
-						//}
+						agentSize = 0;
+						MPI_Unpack(recvBuffers[nb], recvSizes[nb], &position, &agentSize, 1, MPI_INT, MPI_COMM_WORLD);
+						unsigned char* serializedAgent = new unsigned char[agentSize];
+						MPI_Unpack(recvBuffers[nb], recvSizes[nb], &position, serializedAgent, agentSize, MPI_UNSIGNED_CHAR, MPI_COMM_WORLD);
+						Agent* tmpAgent = Agent::Deseriaize(serializedAgent);
+						simulator->addTempAgent(tmpAgent);
+						delete[] serializedAgent;
+					}
+					while (position < recvSizes[nb]);
+					delete[] recvBuffers[nb];
+				}
+			}
+		}
+	}
+	catch(const std::runtime_error& re)
+	{
+	    // speciffic handling for runtime_error
+		std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
+	    std::cerr << "Runtime error: " << re.what() << std::endl;
+		PRINT_STACK_TRACE
+	}
+	catch(const std::exception& ex)
+	{
+	    // speciffic handling for all exceptions extending std::exception, except
+	    // std::runtime_error which is handled explicitly
+		std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
+	    std::cerr << "Error occurred: " << ex.what() << std::endl;
+		PRINT_STACK_TRACE
+	}
+	catch(...)
+	{
+		std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;	
+		PRINT_STACK_TRACE
+		MPI_Finalize();
+		exit(EXIT_FAILURE);
+	}
+
+}
+
+//Datatype of AgentPositionRecord, resized to the struct size so arrays of records are sent without packing
+void CommitAgentPositionType()
+{
+	AgentPositionRecord record;
+	int blockLengths[2] = {1, 2};
+	MPI_Aint displacements[2];
+	MPI_Datatype types[2] = {MPI_LONG_LONG_INT, MPI_FLOAT};
+	MPI_Aint base;
+	MPI_Get_address(&record, &base);
+	MPI_Get_address(&record.agentID, &displacements[0]);
+	MPI_Get_address(&record.x, &displacements[1]);
+	displacements[0] -= base;
+	displacements[1] -= base;
+
+	MPI_Datatype structType;
+	MPI_Type_create_struct(2, blockLengths, displacements, types, &structType);
+	MPI_Type_create_resized(structType, 0, sizeof(AgentPositionRecord), &agentPositionType);
+	MPI_Type_commit(&agentPositionType);
+	MPI_Type_free(&structType);
+}
+
+//Workers fill records array of their alive agents, main node gathers all of them at once
+void UpdateAgentsPositionOnMainNode()
+{
+	//cout << myRank << " UpdateAgentsPositionOnMainNode started" << endl;
+	try
+	{
+		vector<AgentPositionRecord> records;
+		if(myRank != 0 && myRank < modelingAreas.size() + 1)
+		{
+			records.resize(localAgents.ids.size());
+			for(size_t ag = 0; ag < records.size(); ag++)
+			{
+				records[ag].agentID = localAgents.ids[ag];
+				records[ag].x = localAgents.xs[ag];
+				records[ag].y = localAgents.ys[ag];
+			}
+		}
+
+		int recordsNum = records.size();
+		vector<int> recordsNums(commSize, 0);
+		MPI_Gather(&recordsNum, 1, MPI_INT, &recordsNums[0], 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+		vector<int> displacements(commSize, 0);
+		vector<AgentPositionRecord> allRecords;
+		if(myRank == 0)
+		{
+			for(int i = 1; i < commSize; i++)
+			{
+				displacements[i] = displacements[i - 1] + recordsNums[i - 1];
+			}
+			allRecords.resize(displacements[commSize - 1] + recordsNums[commSize - 1] + 1);
+		}
+		MPI_Gatherv(records.empty() ? NULL : &records[0], recordsNum, agentPositionType,
+			myRank == 0 ? &allRecords[0] : NULL, &recordsNums[0], &displacements[0], agentPositionType, 0, MPI_COMM_WORLD);
+
+		if(myRank == 0)
+		{
+			for(int node = 1; node < commSize; node++)
+			{
+				for(int i = displacements[node]; i < displacements[node] + recordsNums[node]; i++)
+				{
+					long long agGlobalId = -1;
+					if(NodesAgentsTables[node].Find(allRecords[i].agentID, agGlobalId))
+					{
+						AgentsPositions[agGlobalId] = Vector2(allRecords[i].x, allRecords[i].y);
 					}
 				}
-				else //Sending
+			}
+			//cout << "Agents new positions:" << endl;
+			//for (size_t id = 0; id < AgentsPositions.size(); id++)
+			//{
+			//	cout << "ID: " << id << " x y " << AgentsPositions[id].x() << " "  << AgentsPositions[id].y() << endl; 
+			//} 
+		}
+	}
+	catch(const std::runtime_error& re)
+	{
+	    // speciffic handling for runtime_error
+		std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
+	    std::cerr << "Runtime error: " << re.what() << std::endl;
+		PRINT_STACK_TRACE
+	}
+	catch(const std::exception& ex)
+	{
+	    // speciffic handling for all exceptions extending std::exception, except
+	    // std::runtime_error which is handled explicitly
+		std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
+	    std::cerr << "Error occurred: " << ex.what() << std::endl;
+		PRINT_STACK_TRACE
+	}
+	catch(...)
+	{
+		std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
+		PRINT_STACK_TRACE
+		MPI_Finalize();
+		exit(EXIT_FAILURE);
+		//return;
+	}
+
+	//cout << myRank << " UpdateAgentsPositionOnMainNode finished" << endl;
+}
+
+void DoSimulationStep()
+{
+	//cout << myRank << "start of DoSimulationStep" << endl;
+	try{
+		if(myRank != 0 && myRank < modelingAreas.size() + 1)
+		{
+			//cout << myRank << " simulation step started " << endl;
+			//int sterTimeStart = clock();
+			double stepStartMoment = MPI_Wtime();
+			simulator->doStep();
+			stepsTime += MPI_Wtime() - stepStartMoment;
+			CollectingLocalAgents();
+			//auto listOfAlAndDeadAgents = simulator->getCountOfAliveAndDead();
+			//cout << "Agents count: " << listOfAlAndDeadAgents[0] << endl;
+			//cout << "Alive: " << listOfAlAndDeadAgents[1] << endl;
+			//cout << "Dead: " << listOfAlAndDeadAgents[2] << endl;
+
+			//cout << myRank << " simulation step finished " << endl;
+			//printf ("%d rank - Step time: (%f seconds).\n", myRank,((float)clock() - sterTimeStart)/CLOCKS_PER_SEC);
+		}
+	}
+	catch(const std::runtime_error& re)
+	{
+	    // speciffic handling for runtime_error
+		std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
+	    std::cerr << "Runtime error: " << re.what() << std::endl;
+		PRINT_STACK_TRACE
+	}
+	catch(const std::exception& ex)
+	{
+	    // speciffic handling for all exceptions extending std::exception, except
+	    // std::runtime_error which is handled explicitly
+		std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
+	    std::cerr << "Error occurred: " << ex.what() << std::endl;
+		PRINT_STACK_TRACE
+	}
+	catch(...)
+	{
+		std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
+		PRINT_STACK_TRACE
+		MPI_Finalize();
+		exit(EXIT_FAILURE);
+	}
+	//cout << myRank << "end of DoSimulationStep" << endl;
+}
+
+//Exchanges byte buffers with neighbor areas: buffers sizes first, then non-empty buffers. Arrays are indexed as neighborAreas
+void ExchangeWithNeighbors(vector<vector<unsigned char> > &sendBuffers, vector<vector<unsigned char> > &recvBuffers, int tag)
+{
+	size_t neighborsNum = neighborAreas.size();
+	vector<int> sendSizes(neighborsNum, 0);
+	vector<int> recvSizes(neighborsNum, 0);
+	vector<MPI_Request> requests;
+
+	for(size_t nb = 0; nb < neighborsNum; nb++)
+	{
+		MPI_Request req;
+		MPI_Irecv(&recvSizes[nb], 1, MPI_INT, neighborAreas[nb], tag, MPI_COMM_WORLD, &req);
+		requests.push_back(req);
+		sendSizes[nb] = sendBuffers[nb].size();
+		MPI_Isend(&sendSizes[nb], 1, MPI_INT, neighborAreas[nb], tag, MPI_COMM_WORLD, &req);
+		requests.push_back(req);
+	}
+	if(!requests.empty())
+	{
+		MPI_Waitall(requests.size(), &requests[0], MPI_STATUSES_IGNORE);
+	}
+
+	requests.clear();
+	recvBuffers.assign(neighborsNum, vector<unsigned char>());
+	for(size_t nb = 0; nb < neighborsNum; nb++)
+	{
+		MPI_Request req;
+		if(recvSizes[nb] > 0)
+		{
+			recvBuffers[nb].resize(recvSizes[nb]);
+			MPI_Irecv(&recvBuffers[nb][0], recvSizes[nb], MPI_UNSIGNED_CHAR, neighborAreas[nb], tag + 1, MPI_COMM_WORLD, &req);
+			requests.push_back(req);
+		}
+		if(sendSizes[nb] > 0)
+		{
+			MPI_Isend(&sendBuffers[nb][0], sendSizes[nb], MPI_UNSIGNED_CHAR, neighborAreas[nb], tag + 1, MPI_COMM_WORLD, &req);
+			requests.push_back(req);
+		}
+	}
+	if(!requests.empty())
+	{
+		MPI_Waitall(requests.size(), &requests[0], MPI_STATUSES_IGNORE);
+	}
+}
+
+//Area which contains the point, 0 if the point is outside of all areas
+int FindAreaByPoint(float x, float y)
+{
+	if(PARTITIONING == 2)
+	{
+		if(x < GlobalArea.first.x() || GlobalArea.second.x() < x || y < GlobalArea.first.y() || GlobalArea.second.y() < y)
+		{
+			return 0;
+		}
+		return ownersGrid.owners[ownersGrid.ownersStart[ownersGrid.Cell(x, y)]];
+	}
+
+	//Only areas crossing the cell of the point are checked
+	int cell = ownersGrid.Cell(x, y);
+	for(int i = ownersGrid.ownersStart[cell]; i < ownersGrid.ownersStart[cell + 1]; i++)
+	{
+		const pair<Vector2, Vector2> &area = ownersGrid.areas[ownersGrid.owners[i]];
+		if(area.first.x() <= x && x <= area.second.x()
+			&& area.first.y() <= y && y <= area.second.y())
+		{
+			return ownersGrid.owners[i];
+		}
+	}
+
+	return 0;
+}
+
+//Workers move agents crossed their areas directly to neighbor areas. Main node only receives notices about agents IDs changes.
+//Agents which crossed to not adjacent areas stay on their nodes and are sent to the owners by all nodes migration
+void AgentsShifting()
+{
+	//cout << myRank << "start of AgentsShifting" << endl;
+	try
+	{
+		//Notice is a triple: previous node, agent ID on previous node, agent ID on this node (-1 if the agent left the modeling area)
+		vector<long long> idsNotices;
+		int farAgentsNum = 0;
+
+		if(myRank != 0 && myRank < modelingAreas.size() + 1)
+		{
+			size_t neighborsNum = neighborAreas.size();
+			vector<vector<unsigned char> > sendBuffers(neighborsNum);
+			vector<vector<unsigned char> > recvBuffers;
+			pair<Vector2, Vector2> myArea(modelingAreas[myRank].first, modelingAreas[myRank].second);
+			for(size_t ag = 0; ag < localAgents.ids.size(); ag++)
+			{
+				float x = localAgents.xs[ag];
+				float y = localAgents.ys[ag];
+				if(PARTITIONING == 2 ? FindAreaByPoint(x, y) == myRank
+					: !(x < myArea.first.x() || myArea.second.x() < x || y < myArea.first.y() || myArea.second.y() < y)) //inside of its modeling area
+				{
+					continue;
+				}
+
+				long long agentID = localAgents.ids[ag];
+				int destination = FindAreaByPoint(x, y);
+				int nb = neighborsIndices[destination];
+				if(destination != 0 && nb < 0)
+				{
+					farAgentsNum++;
+					continue;
+				}
+				if(nb >= 0)
 				{
-					buffSize = 0;
-					//cout << myRank << " Im sending to" << nd->first << endl;
-					if(agentsToShift[nd->first].size() > 0)
-					{
-						//cout << agentsToShift[nd->first].size() << " agents data preparing for " << nd->first << endl;
-						for(int i = 0; i < agentsToShift[nd->first].size(); i++)
-						{
-							agentSize = 0;
-							memcpy(&agentSize, agentsToShift[nd->first][i], sizeof(int));
-							buffSize+= sizeof(int) + agentSize;
-						}
-						//cout << myRank << " I have to send " << agentsToShift[nd->first].size() << " agents with size: " << buffSize << endl;
-
-						buffer = new unsigned char[buffSize];
-						position = 0;
-						for(int i = 0; i < agentsToShift[nd->first].size(); i++)
-						{
-							agentSize = 0;
-							memcpy(&agentSize, agentsToShift[nd->first][i], sizeof(int));
-							MPI_Pack(&agentSize, 1, MPI_INT, buffer, buffSize, &position, MPI_COMM_WORLD);
-							MPI_Pack(agentsToShift[nd->first][i], agentSize, MPI_UNSIGNED_CHAR, buffer, buffSize, &position, MPI_COMM_WORLD);
-						}
-						//cout << agentsToShift[nd->first].size() << " agents data packed " << endl;
-
-						MPI_Send(&buffSize, 1, MPI_INT, nd->first, 100, MPI_COMM_WORLD);
-						MPI_Send(buffer, position, MPI_PACKED, nd->first, 100, MPI_COMM_WORLD);
-						//cout << "Data sent" << endl;
-						//cout << myRank << " All data sent " << endl;
-						delete[] buffer;
-					}
-					else
-					{
-						MPI_Send(&buffSize, 1, MPI_INT, nd->first, 100, MPI_COMM_WORLD);
-						//cout << myRank << " Zero sent to " << nd->first << endl;
-					}
+					long long globalID = localAgents.globalIDs[ag];
+					unsigned char* serializedAgent = localAgents.agents[ag]->Serialize();
+					int serializedAgentSize = 0;
+					memcpy(&serializedAgentSize, serializedAgent, sizeof(int));
+
+					//Agent record: ID on this node, global ID, serialized agent
+					vector<unsigned char> &buffer = sendBuffers[nb];
+					size_t offset = buffer.size();
+					buffer.resize(offset + 2 * sizeof(long long) + serializedAgentSize);
+					memcpy(&buffer[offset], &agentID, sizeof(long long));
+					memcpy(&buffer[offset + sizeof(long long)], &globalID, sizeof(long long));
+					memcpy(&buffer[offset + 2 * sizeof(long long)], serializedAgent, serializedAgentSize);
+					delete[] serializedAgent;
+				}
+				else
+				{
+					idsNotices.push_back(myRank);
+					idsNotices.push_back(agentID);
+					idsNotices.push_back(-1);
 				}
+
+				simulator->deleteAgent(agentID);
+				LocalAgentsGlobalIDs.erase(agentID);
 			}
 
-			for(map<int, vector<unsigned char*> >::iterator agtsh = agentsToShift.begin(); agtsh != agentsToShift.end(); ++agtsh)
+			ExchangeWithNeighbors(sendBuffers, recvBuffers, 200);
+
+			for(size_t nb = 0; nb < neighborsNum; nb++)
 			{
-				for(int i = 0; i < agtsh->second.size(); i++)
+				size_t offset = 0;
+				while(offset < recvBuffers[nb].size())
 				{
-					delete[] agtsh->second[i];
+					long long previousID = 0;
+					long long globalID = 0;
+					int serializedAgentSize = 0;
+					memcpy(&previousID, &recvBuffers[nb][offset], sizeof(long long));
+					memcpy(&globalID, &recvBuffers[nb][offset + sizeof(long long)], sizeof(long long));
+					offset += 2 * sizeof(long long);
+					memcpy(&serializedAgentSize, &recvBuffers[nb][offset], sizeof(int));
+
+					long long newAgentId = simulator->addAgent(Agent::Deseriaize(&recvBuffers[nb][offset]));
+					offset += serializedAgentSize;
+					if(globalID >= 0)
+					{
+						LocalAgentsGlobalIDs[newAgentId] = globalID;
+					}
+
+					idsNotices.push_back(neighborAreas[nb]);
+					idsNotices.push_back(previousID);
+					idsNotices.push_back(newAgentId);
 				}
 			}
+		}
+		CollectingLocalAgents();
 
-			for(int i = 0; i < receivedAgents.size(); i++)
-			{
-				Agent* tmpAgent = Agent::Deseriaize(receivedAgents[i]);
-				simulator->addTempAgent(tmpAgent);
-				delete[] receivedAgents[i];
-			}
-			receivedAgents.clear();
+		SendingIDsNotices(idsNotices);
 
-			//cout << " Exchanging finished" << endl; 
-			//printf ("ExchangingByPhantoms time: (%f seconds).\n",((float)clock() - ExchangingByPhantomsStartTime)/CLOCKS_PER_SEC);
+		int totalFarAgentsNum = 0;
+		MPI_Allreduce(&farAgentsNum, &totalFarAgentsNum, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+		if(totalFarAgentsNum > 0)
+		{
+			MigratingAgents();
 		}
 	}
 	catch(const std::runtime_error& re)
@@ -1592,160 +2592,75 @@ void ExchangingByPhantoms()
 	}
 	catch(...)
 	{
-		std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;	
+		std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
 		PRINT_STACK_TRACE
 		MPI_Finalize();
 		exit(EXIT_FAILURE);
 	}
-
-	//cout << myRank << "end of ExchangingByPhantoms" << endl;
+	//cout << myRank << " AgentsShifting finished" << endl;
+	//cout << myRank << "end of AgentsShifting" << endl;
 }
 
-void UpdateAgentsPositionOnMainNode()
+//Main node collects notices about moved agents and updates agents tables.
+//Notice is a triple: previous node, agent ID on previous node, agent ID on the sending node (-1 if the agent left the modeling area)
+void SendingIDsNotices(vector<long long> &idsNotices)
 {
-	//cout << myRank << " UpdateAgentsPositionOnMainNode started" << endl;
+	if(!mainNodeKeepsIDs)
+	{
+		return;
+	}
+
 	try
 	{
-		long long agentId;
+		int noticesSize = idsNotices.size();
+		vector<int> noticesSizes(commSize, 0);
+		MPI_Gather(&noticesSize, 1, MPI_INT, &noticesSizes[0], 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+		vector<int> displacements(commSize, 0);
+		vector<long long> allNotices;
 		if(myRank == 0)
 		{
-			//int requestNewPositionsStartTime = clock();
-			//cout << "modelingAreas.size(): " << modelingAreas.size() << endl;
-			MPI_Status stat;
-			int agentPosSize = sizeof(long long) + sizeof(float) + sizeof(float);
-			for (int areas = 0; areas < modelingAreas.size(); areas++)
-			{
-				//int agentPOsitionsReceivingStartMoment = clock();
-				//int agentsPositionsDataReceivingStartTime = clock();
-				//cout << "Receiving for area " << areas << endl;
-				int agentPosBuffSize;
-				int senderNode;
-				MPI_Recv(&agentPosBuffSize, 1, MPI_INT, MPI_ANY_SOURCE, 0, MPI_COMM_WORLD, &stat);
-				//cout << myRank << "Receiving agentPosBuffSize " <<  agentPosBuffSize << "from " << stat.MPI_SOURCE << endl;
-				if(agentPosBuffSize > 0)
-				{
-					unsigned char* agentsPositionsBuffer;
-					try
-					{
-						//agentsPositionsDataReceivingStartTime = clock();
-						senderNode = stat.MPI_SOURCE;
-						agentsPositionsBuffer = new unsigned char[agentPosBuffSize];
-					}
-					catch (std::bad_alloc& ba) 
-					{
-						cerr << ba.what() <<  " Memory overflow at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << endl;	
-						PRINT_STACK_TRACE
-						MPI_Finalize();
-						exit(EXIT_FAILURE);
-					}
-					catch(const std::runtime_error& re)
-					{
-					    // speciffic handling for runtime_error
-						std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
-					    std::cerr << "Runtime error: " << re.what() << std::endl;
-						PRINT_STACK_TRACE
-					}
-					catch(const std::exception& ex)
-					{
-					    // speciffic handling for all exceptions extending std::exception, except
-					    // std::runtime_error which is handled explicitly
-						std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
-					    std::cerr << "Error occurred: " << ex.what() << std::endl;
-						PRINT_STACK_TRACE
-					}
-					catch(...)
-					{
-						std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
-						PRINT_STACK_TRACE
-						MPI_Finalize();
-						exit(EXIT_FAILURE);
-						//return;
-					}
-					//cout << myRank << "Agents position buffer receiving started from " << senderNode << " size: " << agentPosBuffSize <<  endl;
-					MPI_Recv(agentsPositionsBuffer, agentPosBuffSize, MPI_UNSIGNED_CHAR, senderNode, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-					//cout << myRank << "Agents position buffer received " << endl;
-					int agentPositionsNum = agentPosBuffSize / agentPosSize;
-					int position = 0;
-					//cout << "Agents pos num: " << agentPositionsNum << endl;
-					for(int agPos = 0; agPos < agentPositionsNum; agPos++)
-					{
-						float xPos, yPos;
-						MPI_Unpack(agentsPositionsBuffer, agentPosBuffSize, &position, &agentId, 1, MPI_LONG_LONG_INT, MPI_COMM_WORLD);
-						MPI_Unpack(agentsPositionsBuffer, agentPosBuffSize, &position, &xPos, 1, MPI_FLOAT, MPI_COMM_WORLD);
-						MPI_Unpack(agentsPositionsBuffer, agentPosBuffSize, &position, &yPos, 1, MPI_FLOAT, MPI_COMM_WORLD);
-
-						//cout << "Agents ID: " << agentId << " xPos: " << xPos << " yPos: " << yPos << endl;
-						long long agGlobalId = NodesAgentsMap[senderNode][agentId];
-						AgentsPositions[agGlobalId] = Vector2(xPos, yPos);
-					}
-
-					delete[] agentsPositionsBuffer;
-					//printf ("Data requestung time: (%f seconds).\n",((float)clock() - agentsPositionsDataReceivingStartTime)/CLOCKS_PER_SEC);
-				}
-				//else
-				//{
-				//	cout << myRank << "No agents from " << stat.MPI_SOURCE << endl;
-				//}
-
-				//printf ("Waiting time: (%f seconds).\n", (float)(agentsPositionsDataReceivingStartTime - agentPOsitionsReceivingStartMoment)/CLOCKS_PER_SEC);
+			for(int i = 1; i < commSize; i++)
+			{
+				displacements[i] = displacements[i - 1] + noticesSizes[i - 1];
 			}
-			//cout << " Requesring finished" << endl;
-			//cout << "Agents new positions:" << endl;
-			//for (std::map<long long, Vector2>::iterator it= AgentsPositions.begin(); it != AgentsPositions.end(); ++it)
-			//{
-			//	cout << "ID: " << it->first << " x y " << it->second.x() << " "  << it->second.y() << endl; 
-			//} 
-			//printf ("Requesting new positions time: (%f seconds).\n",((float)clock() - requestNewPositionsStartTime)/CLOCKS_PER_SEC);
+			allNotices.resize(displacements[commSize - 1] + noticesSizes[commSize - 1] + 1);
 		}
-		else
+		MPI_Gatherv(idsNotices.empty() ? NULL : &idsNotices[0], noticesSize, MPI_LONG_LONG_INT,
+			myRank == 0 ? &allNotices[0] : NULL, &noticesSizes[0], &displacements[0], MPI_LONG_LONG_INT, 0, MPI_COMM_WORLD);
+
+		if(myRank == 0)
 		{
-			if(myRank < modelingAreas.size() + 1)
+			for(int node = 1; node < commSize; node++)
 			{
-				//int agentsNewPositionsStartMoment = clock();
-
-				//Requesting vector with requesting agents IDs
-				int agentPosSize = sizeof(long long) + sizeof(float) + sizeof(float);
-				int sizeOfAgentPosBuff = 0;
-				//vector<size_t> agentsIds = simulator->getAliveAgentIdsList();
-				vector<Agent*> aliveAagents = simulator->getAliveAgents();
-				if(aliveAagents.size() > 0)
+				for(int i = displacements[node]; i < displacements[node] + noticesSizes[node]; i += 3)
 				{
-					//cout << myRank << " I have " << aliveAagents.size() << " alive agents" << endl;
-					int AgentPosBuffSize = agentPosSize * aliveAagents.size();
-					unsigned char* AgentPosBuffer = new unsigned char[AgentPosBuffSize];
-					int position = 0;
-
-					//printf ("Alive agents requesting time: (%f seconds).\n",((float)clock() - agentsNewPositionsStartMoment)/CLOCKS_PER_SEC);
+					int previousNode = allNotices[i];
+					long long previousID = allNotices[i + 1];
+					long long newAgentId = allNotices[i + 2];
 
-					//agentsNewPositionsStartMoment = clock();
-					MPIAgent agent;
-					for(int ag = 0; ag < aliveAagents.size(); ag++)
+					long long globalID = -1;
+					if(!NodesAgentsTables[previousNode].Find(previousID, globalID))
 					{
-						//Agent* tmpAgent = simulator->getAgent(agentsIds[ag]);
-						agent.agent = aliveAagents[ag]; // simulator->getAgent(agentsIds[ag]);
-						agentId = agent.ID();
-						float xPos = agent.Position().x();
-						float yPos = agent.Position().y();
-
-						//cout << "AgID: " << agentId << " xPos: " << xPos << " yPos: " << yPos << endl;
-						MPI_Pack(&agentId, 1, MPI_LONG_LONG_INT, AgentPosBuffer, AgentPosBuffSize, &position, MPI_COMM_WORLD);
-						MPI_Pack(&xPos, 1, MPI_FLOAT, AgentPosBuffer, AgentPosBuffSize, &position, MPI_COMM_WORLD);
-						MPI_Pack(&yPos, 1, MPI_FLOAT, AgentPosBuffer, AgentPosBuffSize, &position, MPI_COMM_WORLD);
+						cerr << " Unknown agent " << previousID << " of node " << previousNode << " at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << endl;
+						continue;
 					}
+					NodesAgentsTables[previousNode].Erase(previousID);
 
-					//printf ("Agents positions packing time: (%f seconds).\n",((float)clock() - agentsNewPositionsStartMoment)/CLOCKS_PER_SEC);
-					//agentsNewPositionsStartMoment = clock();
-					MPI_Send(&AgentPosBuffSize, 1, MPI_INT, 0, 0, MPI_COMM_WORLD);
-					//cout << myRank << "AgentPosBuffSize: " << AgentPosBuffSize << " sent position: "  << position << endl;
-					MPI_Send(AgentPosBuffer, position, MPI_PACKED, 0, 1, MPI_COMM_WORLD);
-					//cout << myRank << "Buffer sent " << endl;
-					delete[] AgentPosBuffer;
-					//printf ("Agents positions sending time: (%f seconds).\n",((float)clock() - agentsNewPositionsStartMoment)/CLOCKS_PER_SEC);
-				}
-				else
-				{ 
-					//cout << myRank << " I dont have any agents " << endl;
-					MPI_Send(&sizeOfAgentPosBuff, 1, MPI_INT, 0, 0, MPI_COMM_WORLD);
+					if(newAgentId < 0) //If agent was outside of area but no other nodes serve for it
+					{
+						AgentsDeleted[globalID] = 1;
+						if(mainNodeKeepsPositions)
+						{
+							AgentsPositions[globalID] = Vector2(INT_MIN, INT_MIN);
+						}
+					}
+					else
+					{
+						NodesAgentsTables[node].Insert(newAgentId, globalID);
+						AgentsNodeIDs[globalID] = node;
+						AgentsLocalIDs[globalID] = newAgentId;
+					}
 				}
 			}
 		}
@@ -1771,29 +2686,128 @@ void UpdateAgentsPositionOnMainNode()
 		PRINT_STACK_TRACE
 		MPI_Finalize();
 		exit(EXIT_FAILURE);
-		//return;
 	}
-
-	//cout << myRank << " UpdateAgentsPositionOnMainNode finished" << endl;
 }
 
-void DoSimulationStep()
+//Every agent gets the share of its node average step time since the last rebalancing. Bisection or curve cuts slide to balance these loads,
+//the new areas are taken if the predicted gain until the next rebalancing exceeds the agents migration cost
+void RebalancingAreas(int currentIteration, int iterationNum)
 {
-	//cout << myRank << "start of DoSimulationStep" << endl;
-	try{
+	try
+	{
+		size_t cellsNum = partitionGrid.weights.size();
+		vector<double> localGrid(2 * cellsNum, 0); //cells loads, then cells agents counts
+		double stepTime = 0;
 		if(myRank != 0 && myRank < modelingAreas.size() + 1)
 		{
-			//cout << myRank << " simulation step started " << endl;
-			//int sterTimeStart = clock();
-			simulator->doStep();
-			//auto listOfAlAndDeadAgents = simulator->getCountOfAliveAndDead();
-			//cout << "Agents count: " << listOfAlAndDeadAgents[0] << endl;
-			//cout << "Alive: " << listOfAlAndDeadAgents[1] << endl;
-			//cout << "Dead: " << listOfAlAndDeadAgents[2] << endl;
+			size_t agentsNum = localAgents.ids.size();
+			stepTime = stepsTime / REBALANCING_INTERVAL;
+			double agentLoad = agentsNum == 0 ? 0 : stepTime / agentsNum;
+			for(size_t ag = 0; ag < agentsNum; ag++)
+			{
+				int cell = partitionGrid.Cell(localAgents.xs[ag], localAgents.ys[ag]);
+				localGrid[cell] += agentLoad;
+				localGrid[cellsNum + cell] += 1;
+			}
+		}
+		stepsTime = 0;
 
-			//cout << myRank << " simulation step finished " << endl;
-			//printf ("%d rank - Step time: (%f seconds).\n", myRank,((float)clock() - sterTimeStart)/CLOCKS_PER_SEC);
+		vector<double> globalGrid(2 * cellsNum, 0);
+		MPI_Allreduce(&localGrid[0], &globalGrid[0], globalGrid.size(), MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+		double maxStepTime = 0;
+		MPI_Allreduce(&stepTime, &maxStepTime, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+
+		//Empty cells keep a small part of the average agent load, so empty space is still divided geometrically
+		double totalLoad = 0;
+		double agentsNum = 0;
+		for(size_t cell = 0; cell < cellsNum; cell++)
+		{
+			totalLoad += globalGrid[cell];
+			agentsNum += globalGrid[cellsNum + cell];
+		}
+		double emptyCellLoad = EMPTY_CELL_WEIGHT * totalLoad / max(1.0, agentsNum);
+		for(size_t cell = 0; cell < cellsNum; cell++)
+		{
+			partitionGrid.weights[cell] = globalGrid[cell] + emptyCellLoad;
+		}
+
+		double predictedMaxStepTime = 0;
+		double migratingAgentsNum = 0; //agents in cells which change the owner
+		size_t areasNum = modelingAreas.size();
+		vector<CellsRange> newRanges;
+		vector<int> newCuts;
+		if(PARTITIONING == 2)
+		{
+			//Areas keep their places on the curve, only cut points move
+			CutCurve(partitionGrid, areasNum, newCuts);
+			for(size_t area = 0; area < areasNum; area++)
+			{
+				double load = 0;
+				for(int position = newCuts[area]; position < newCuts[area + 1]; position++)
+				{
+					int cell = curveCells[position];
+					load += partitionGrid.weights[cell];
+					if(cellsOwners[cell] != area + 1)
+					{
+						migratingAgentsNum += globalGrid[cellsNum + cell];
+					}
+				}
+				predictedMaxStepTime = max(predictedMaxStepTime, load);
+			}
+		}
+		else
+		{
+			//The same bisection tree is used, so areas keep their IDs and neighbors and only cuts move
+			CellsRange globalRange = {0, 0, partitionGrid.columns, partitionGrid.rows};
+			size_t axisIndex = 0;
+			if(!BisectCellsRange(partitionGrid, globalRange, areasNum, partitionMinCells, bisectionAxes, axisIndex, newRanges))
+			{
+				return;
+			}
+
+			for(size_t i = 0; i < areasNum; i++)
+			{
+				predictedMaxStepTime = max(predictedMaxStepTime, CellsRangeWeight(partitionGrid, newRanges[i]));
+				for(int row = areasRanges[i].firstRow; row < areasRanges[i].lastRow; row++)
+				{
+					for(int column = areasRanges[i].firstColumn; column < areasRanges[i].lastColumn; column++)
+					{
+						if(row < newRanges[i].firstRow || row >= newRanges[i].lastRow || column < newRanges[i].firstColumn || column >= newRanges[i].lastColumn)
+						{
+							migratingAgentsNum += globalGrid[cellsNum + row * partitionGrid.columns + column];
+						}
+					}
+				}
+			}
+		}
+
+		//Nodes send their agents in parallel
+		double gain = (maxStepTime - predictedMaxStepTime) * min(REBALANCING_INTERVAL, iterationNum - 1 - currentIteration);
+		double migrationCost = migratingAgentsNum * REBALANCING_MIGRATION_COST / areasNum;
+		bool rebalance = gain > migrationCost;
+		if(myRank == 0)
+		{
+			printf ("Iteration: %d max step time: %f predicted: %f gain: %f seconds, migrating agents: %.0f cost: %f seconds, rebalancing: %s\n",
+				currentIteration, maxStepTime, predictedMaxStepTime, gain, migratingAgentsNum, migrationCost, rebalance ? "yes" : "no");
+		}
+		if(!rebalance)
+		{
+			return;
+		}
+
+		if(PARTITIONING == 2)
+		{
+			curveCuts = newCuts;
+			modelingAreas = CurveModelingAreas(GlobalArea);
+		}
+		else
+		{
+			areasRanges = newRanges;
+			modelingAreas = AreasFromCellsRanges(partitionGrid, areasRanges, GlobalArea);
 		}
+		IndexingAreas();
+		AddingAreaObstacles();
+		MigratingAgents();
 	}
 	catch(const std::runtime_error& re)
 	{
@@ -1817,197 +2831,113 @@ void DoSimulationStep()
 		MPI_Finalize();
 		exit(EXIT_FAILURE);
 	}
-	//cout << myRank << "end of DoSimulationStep" << endl;
 }
 
-void AgentsShifting()
+//After rebalancing or far crossings agents outside of their node area are sent to their owners at once, they arent always neighbors.
+//Records are the same as in AgentsShifting: ID on this node, global ID, serialized agent
+void MigratingAgents()
 {
-	//cout << myRank << "start of AgentsShifting" << endl;
-	//cout << myRank << " AgentsShifting started" << endl;
 	try
 	{
-		int destinationNode = 0;
-		if(myRank == 0)
+		vector<long long> idsNotices;
+		vector<vector<unsigned char> > sendBuffers(commSize);
+		if(myRank != 0 && myRank < modelingAreas.size() + 1)
 		{
-			float x, y;
-			//int agentsSHiftingTimeStart = clock();
-			map<long long, MPIAgent> agentsToShift;
-			//cout << myRank << "agents shifting started" << endl;
-			//cout << "Rank: " << myRank << " Sending agents IDs for deleting from simulators"<< endl;
-			for (std::map<long long, AgentOnNodeInfo>::iterator it= AgentsIDMap.begin(); it != AgentsIDMap.end(); ++it)
+			pair<Vector2, Vector2> myArea(modelingAreas[myRank].first, modelingAreas[myRank].second);
+			for(size_t ag = 0; ag < localAgents.ids.size(); ag++)
 			{
-				if(!it->second.isDeleted)
+				float x = localAgents.xs[ag];
+				float y = localAgents.ys[ag];
+				if(PARTITIONING == 2 ? FindAreaByPoint(x, y) == myRank
+					: !(x < myArea.first.x() || myArea.second.x() < x || y < myArea.first.y() || myArea.second.y() < y)) //inside of its modeling area
 				{
-					x = AgentsPositions[it->first].x();
-					y = AgentsPositions[it->first].y();
-					int node = it->second._nodeID;
-					if(x < modelingAreas[node].first.x() || modelingAreas[node].second.x() < x || //outside of its modeling area
-						y < modelingAreas[node].first.y() || modelingAreas[node].second.y() < y)
-					{
-						//cout << "gloablID: " << it->first << " localID: " << it->second._agentID <<   " Node:" << node << endl;
-						//cout << "agent in coords: " << x << " " << y << " not inside an area: x:" << modelingAreas[node].first.x() << " y:" << modelingAreas[node].first.y() << " x:" << modelingAreas[node].second.x() << " y:" << modelingAreas[node].second.y() << endl; 
-						int destination = it->second._nodeID;
-						MPI_Bcast(&destination, 1, MPI_INT, 0, MPI_COMM_WORLD);
-						//cout << "Rank: " << myRank << " Bcasted destination node: " << destination << endl;
-						MPI_Send(&it->second._agentID, 1, MPI_LONG_LONG_INT, destination, 0, MPI_COMM_WORLD);
-						//cout << "Rank: " << myRank << " ID sended: " << it->second._agentID << endl;
-						int serializedAgentSize = 0;
-						MPI_Recv(&serializedAgentSize, 1, MPI_INT, destination, 0, MPI_COMM_WORLD, MPI_STATUSES_IGNORE);
-						//cout << "Rank: " << myRank << " Receiving serialized agent with size: " << serializedAgentSize << endl;
-						unsigned char* serializedAgent = new unsigned char[serializedAgentSize];
-						MPI_Recv(serializedAgent, serializedAgentSize, MPI_UNSIGNED_CHAR, destination, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-						//cout << "Rank: " << myRank << " Agent received " << endl;
-						agentsToShift[it->first] = MPIAgent(Agent::Deseriaize(serializedAgent));
-						delete[] serializedAgent;
-					}
+					continue;
 				}
-			}
-
-			//cout << "agents to shift: " << agentsToShift.size() << endl;
-
-			//cout << "Rank: " << myRank << " Bcasting finish flag: " << endl;
-			destinationNode = -1;
-			MPI_Bcast(&destinationNode, 1, MPI_INT, 0, MPI_COMM_WORLD);  //End of agents shifting requests
-			//cout << "Receiving agents to remove finished " << endl;
-
-			//cout << "Sending agents to new areas started " << endl;
-			std::set<long long> shiftedAgents;
-			for (std::map<long long, MPIAgent>::iterator it = agentsToShift.begin(); it != agentsToShift.end(); ++it) //Sending agents to destination nodes
-			{
-				//cout << "Agent global id: " << it->first << endl;
-				float x = it->second.Position().x();
-				float y = it->second.Position().y();
 
-				//for(int ar = 0; ar < modelingAreas.size(); ar++)
-				for(map<int, pair<Vector2, Vector2> > :: iterator ar = modelingAreas.begin(); ar != modelingAreas.end(); ++ar)
+				long long agentID = localAgents.ids[ag];
+				int destination = FindAreaByPoint(x, y);
+				if(destination != 0)
 				{
-					if(ar->second.first.x() <= x && x <= ar->second.second.x()
-						&& ar->second.first.y() <= y && y <= ar->second.second.y())
-					{
-						int nodeID = ar->first;
-						//cout << "Agent new node: " << nodeID << endl;
-						MPI_Bcast(&nodeID, 1, MPI_INT, 0, MPI_COMM_WORLD); //Bcasing index of target node who should receive new agents
-						//cout << "Rank: " << myRank << " Bcasting destination node: " << nodeID << endl;
-
-						unsigned char* serializedAgent = it->second.SerializeAgent();
-
-						int SerializedAgentSize = 0;
-						memcpy(&SerializedAgentSize, serializedAgent, sizeof(int));
-
-						MPI_Send(&SerializedAgentSize, 1, MPI_INT, nodeID, 0, MPI_COMM_WORLD);
-						//cout << "Rank: " << myRank << " sending size: " << SerializedAgentSize << " to: " << nodeID << endl;
-						MPI_Send(serializedAgent, SerializedAgentSize, MPI_UNSIGNED_CHAR, nodeID, 0, MPI_COMM_WORLD);
-						//cout << "Rank: " << myRank << " agent sent." << endl;
-
-						long long newAgentId = 0;
-						//cout << "Rank: " << myRank << " agent sent." << newAgentId << endl;
-						MPI_Recv(&newAgentId, 1, MPI_UNSIGNED_LONG_LONG, nodeID, 0, MPI_COMM_WORLD, MPI_STATUSES_IGNORE);
-
-						NodesAgentsMap[AgentsIDMap[it->first]._nodeID].erase(AgentsIDMap[it->first]._agentID);
-						NodesAgentsMap[nodeID][newAgentId] = it->first;
-
-						AgentsIDMap[it->first]._nodeID = nodeID;
-						AgentsIDMap[it->first]._agentID = newAgentId;
-
-						shiftedAgents.insert(it->first);
-						delete[] serializedAgent;
-						break;
-					}
+					long long globalID = localAgents.globalIDs[ag];
+					unsigned char* serializedAgent = localAgents.agents[ag]->Serialize();
+					int serializedAgentSize = 0;
+					memcpy(&serializedAgentSize, serializedAgent, sizeof(int));
+
+					vector<unsigned char> &buffer = sendBuffers[destination];
+					size_t offset = buffer.size();
+					buffer.resize(offset + 2 * sizeof(long long) + serializedAgentSize);
+					memcpy(&buffer[offset], &agentID, sizeof(long long));
+					memcpy(&buffer[offset + sizeof(long long)], &globalID, sizeof(long long));
+					memcpy(&buffer[offset + 2 * sizeof(long long)], serializedAgent, serializedAgentSize);
+					delete[] serializedAgent;
 				}
-			}
-
-			//cout << "Rank: " << myRank << " Bcasting finish flag: " << endl;
-			destinationNode = -1;
-			MPI_Bcast(&destinationNode, 1, MPI_INT, 0, MPI_COMM_WORLD);  //End of agents shifting requests
-
-			//Deleting agents that succesfully shifted
-			std::map<long long, MPIAgent>::iterator agent_it;
-			for (std::set<long long>::iterator it = shiftedAgents.begin(); it != shiftedAgents.end(); ++it)
-			{
-				agent_it = agentsToShift.find(*it);
-				if (agent_it != agentsToShift.end())
+				else
 				{
-					agent_it->second.DeleteAgent();
-					agentsToShift.erase(agent_it);
+					idsNotices.push_back(myRank);
+					idsNotices.push_back(agentID);
+					idsNotices.push_back(-1);
 				}
-			}
 
-			if(agentsToShift.size() > 0)//If some of agents were outside of area but no other nodes serve for it
-			{
-				for (std::map<long long, MPIAgent>::iterator it = agentsToShift.begin(); it != agentsToShift.end(); ++it)
-				{
-					it->second.DeleteAgent();
-					AgentsIDMap[it->first].isDeleted = true;
-					AgentsPositions[it->first] = Vector2(INT_MIN, INT_MIN);
-				}
+				simulator->deleteAgent(agentID);
+				LocalAgentsGlobalIDs.erase(agentID);
 			}
+		}
 
-			//destinationNode = -1;
-			//MPI_Bcast(&destinationNode, 1, MPI_INT, 0, MPI_COMM_WORLD); //End of agents shifting
-			//printf ("Agents shifting time: (%f seconds).\n",((float)clock() - agentsSHiftingTimeStart)/CLOCKS_PER_SEC);
+		vector<int> sendSizes(commSize, 0);
+		vector<int> recvSizes(commSize, 0);
+		vector<int> sendDisplacements(commSize, 0);
+		vector<int> recvDisplacements(commSize, 0);
+		for(int node = 0; node < commSize; node++)
+		{
+			sendSizes[node] = sendBuffers[node].size();
 		}
-		else
+		MPI_Alltoall(&sendSizes[0], 1, MPI_INT, &recvSizes[0], 1, MPI_INT, MPI_COMM_WORLD);
+		for(int node = 1; node < commSize; node++)
 		{
-			if(myRank < modelingAreas.size() + 1)
-			{
-				//cout << "rank: " << myRank << " receiving agents ID to delete from simulation." << endl;
-				//cout << "node: " << myRank << " moving agents crossed modeling areas started " << endl;
-				do
-				{
-					MPI_Bcast(&destinationNode, 1, MPI_INT, 0, MPI_COMM_WORLD); //Check if it information about agent on this node
-					//cout << "rank: " << myRank << " destination: " << destinationNode << endl;
-					if (destinationNode == myRank)
-					{
-						long long agentID;
-						MPI_Recv(&agentID, 1, MPI_LONG_LONG_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-						//cout << "rank: " << myRank << " agentID: " << agentID << endl;
-						Agent* agent = simulator->getAgent(agentID);
-
-						MPIAgent mpiTmpAgent(agent);
-						unsigned char* serializedAgent = agent->Serialize();
-
-						int SerializedAgentSize = 0;
-						memcpy(&SerializedAgentSize, serializedAgent, sizeof(int));
-
-						MPI_Send(&SerializedAgentSize, 1, MPI_INT, 0, 0, MPI_COMM_WORLD);
-						//cout << "rank: " << myRank << " agent size sended:" << SerializedAgentSize << endl;
-
-						MPI_Send(serializedAgent, SerializedAgentSize, MPI_UNSIGNED_CHAR, 0, 0, MPI_COMM_WORLD);
-						//cout << "rank: " << myRank << " agent sent." << endl;
+			sendDisplacements[node] = sendDisplacements[node - 1] + sendSizes[node - 1];
+			recvDisplacements[node] = recvDisplacements[node - 1] + recvSizes[node - 1];
+		}
 
-						simulator->deleteAgent(agentID);
-						//simulator->setAgentPosition(agentID, Vector2(INT_MIN, INT_MIN));
-						//simulator->setAgentPrefVelocity(agentID, Vector2(0, 0));
-						//cout << "rank: " << myRank << " agent deleted from simulation" << endl;
-						delete[] serializedAgent;
-					}
-				} while (destinationNode > 0);
-				//cout << "rank: " << myRank << " deleting agents from simulation finished" << endl;
+		vector<unsigned char> sendBuffer(sendDisplacements[commSize - 1] + sendSizes[commSize - 1] + 1);
+		vector<unsigned char> recvBuffer(recvDisplacements[commSize - 1] + recvSizes[commSize - 1] + 1);
+		for(int node = 0; node < commSize; node++)
+		{
+			if(sendSizes[node] > 0)
+			{
+				memcpy(&sendBuffer[sendDisplacements[node]], &sendBuffers[node][0], sendSizes[node]);
+			}
+		}
+		MPI_Alltoallv(&sendBuffer[0], &sendSizes[0], &sendDisplacements[0], MPI_UNSIGNED_CHAR,
+			&recvBuffer[0], &recvSizes[0], &recvDisplacements[0], MPI_UNSIGNED_CHAR, MPI_COMM_WORLD);
 
-				//cout << "rank: " << myRank << " receiving agents to add to a simulation " << endl;
-				do
+		for(int node = 0; node < commSize; node++)
+		{
+			size_t offset = recvDisplacements[node];
+			while(offset < (size_t)(recvDisplacements[node] + recvSizes[node]))
+			{
+				long long previousID = 0;
+				long long globalID = 0;
+				int serializedAgentSize = 0;
+				memcpy(&previousID, &recvBuffer[offset], sizeof(long long));
+				memcpy(&globalID, &recvBuffer[offset + sizeof(long long)], sizeof(long long));
+				offset += 2 * sizeof(long long);
+				memcpy(&serializedAgentSize, &recvBuffer[offset], sizeof(int));
+
+				long long newAgentId = simulator->addAgent(Agent::Deseriaize(&recvBuffer[offset]));
+				offset += serializedAgentSize;
+				if(globalID >= 0)
 				{
-					MPI_Bcast(&destinationNode, 1, MPI_INT, 0, MPI_COMM_WORLD); //Check if it information about agent on this node
-					//cout << "rank: " << myRank << " destination node: " << destinationNode << endl;
-					if (destinationNode == myRank)
-					{
-						int SerializedAgentSize = 0; 
-						MPI_Recv(&SerializedAgentSize, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-
-						unsigned char* buffForReceivingAgent = new unsigned char[SerializedAgentSize];
-						MPI_Recv(buffForReceivingAgent, SerializedAgentSize, MPI_UNSIGNED_CHAR, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-						//cout << "rank: " << myRank << " agent received." << endl;
+					LocalAgentsGlobalIDs[newAgentId] = globalID;
+				}
 
-						long long newAgentId = simulator->addAgent(Agent::Deseriaize(buffForReceivingAgent));
-						MPI_Send(&newAgentId, 1, MPI_UNSIGNED_LONG_LONG, 0, 0, MPI_COMM_WORLD );
-						//cout << "rank: " << myRank << " agent added to simulation. New ID: " << newAgentId << endl;
-						delete[] buffForReceivingAgent;
-					}
-				} while (destinationNode > 0);
-				//cout << "rank: " << myRank << " receiving agents to add to a simulation finished" << endl;
-				//cout << "node: " << myRank << " moving agents crossed modeling areas finished " << endl;
+				idsNotices.push_back(node);
+				idsNotices.push_back(previousID);
+				idsNotices.push_back(newAgentId);
 			}
 		}
+		CollectingLocalAgents();
+
+		SendingIDsNotices(idsNotices);
 	}
 	catch(const std::runtime_error& re)
 	{
@@ -2031,185 +2961,48 @@ void AgentsShifting()
 		MPI_Finalize();
 		exit(EXIT_FAILURE);
 	}
-	//cout << myRank << " AgentsShifting finished" << endl;
-	//cout << myRank << "end of AgentsShifting" << endl;
 }
 
-void SavingModelingData(int currentIteration, const string &filename)
+//Main node fills the frame from agents arrays and hands it to the writer thread, so writing doesnt block the simulation.
+//With distributed output every worker fills the frame with its own agents and all nodes write it collectively
+void SavingModelingData(int currentIteration)
 {
-	int iterationForWritingToFile = 10;
 	//cout << myRank << "start of SavingModelingData" << endl;
 	try
 	{
-		if(myRank == 0)
+		if(TRAJECTORY_OUTPUT == 1)
+		{
+			savingFrame.Clear();
+			savingFrame.iteration = currentIteration;
+			if(myRank != 0 && myRank < modelingAreas.size() + 1)
+			{
+				savingFrame.ids = localAgents.globalIDs;
+				savingFrame.xs = localAgents.xs;
+				savingFrame.ys = localAgents.ys;
+				savingFrame.flags.assign(localAgents.ids.size(), 0);
+			}
+			distributedTrajectoryWriter->Write(savingFrame);
+		}
+		else if(myRank == 0)
 		{
 			//int savingDataStartTime = clock();
-			pair< int, map<long long, pair<Vector2, AgentOnNodeInfo> > > iterationData;
-			std::map<long long, AgentOnNodeInfo>::iterator it;
-			try
+			savingFrame.iteration = currentIteration;
+			for (long long id = 0; id < AgentsNodeIDs.size(); id++)
 			{
-
-				for (it = AgentsIDMap.begin(); it != AgentsIDMap.end(); ++it)
+				if (AgentsNodeIDs[id] < 0) //agent was never added to the modeling
 				{
-					Vector2 agentPosition;
-					long long id = it->first;
-					AgentOnNodeInfo* agInfo = &it->second; 
-					try
-					{
-						map<long long, Vector2>::iterator pos = AgentsPositions.find(id);
-						if(pos != AgentsPositions.end())
-						{
-							agentPosition = Vector2(AgentsPositions[id].x(), AgentsPositions[id].y());
-						}
-						else
-						{
-							cerr<< " AgentsPositions map  doesnt contain agent with ID: " << it->first << " at file: " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
-							agentPosition = Vector2(-1, -1);
-						}
-					}
-					catch(const std::runtime_error& re)
-					{
-					    // speciffic handling for runtime_error
-						std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
-					    std::cerr << "Runtime error: " << re.what() << std::endl;
-						PRINT_STACK_TRACE
-					}
-					catch(const std::exception& ex)
-					{
-					    // speciffic handling for all exceptions extending std::exception, except
-					    // std::runtime_error which is handled explicitly
-						std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
-					    std::cerr << "Error occurred: " << ex.what() << std::endl;
-						PRINT_STACK_TRACE
-					}
-					catch(...)
-					{
-						std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
-						std::cerr << " Iterator key: " << it->first << std::endl;
-						PRINT_STACK_TRACE
-						MPI_Finalize();
-						exit(EXIT_FAILURE);
-					}
-
-					AgentOnNodeInfo nodeAg;
-
-					try
-					{
-						nodeAg = AgentOnNodeInfo(agInfo->_nodeID, agInfo->_agentID, agInfo->isDeleted);//(it->second._nodeID,it->second._agentID, it->second.isDeleted);
-					}
-					catch(const std::runtime_error& re)
-					{
-					    // speciffic handling for runtime_error
-						std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
-					    std::cerr << "Runtime error: " << re.what() << std::endl;
-						PRINT_STACK_TRACE
-					}
-					catch(const std::exception& ex)
-					{
-					    // speciffic handling for all exceptions extending std::exception, except
-					    // std::runtime_error which is handled explicitly
-						std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
-					    std::cerr << "Error occurred: " << ex.what() << std::endl;
-						PRINT_STACK_TRACE
-					}
-					catch(...)
-					{
-						std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
-						std::cerr << " Iterator key: " << it->first << std::endl;
-						PRINT_STACK_TRACE
-						MPI_Finalize();
-						exit(EXIT_FAILURE);
-					}
-
-					try
-					{
-						iterationData.first = currentIteration;
-						iterationData.second[id] = pair<Vector2, AgentOnNodeInfo>(agentPosition, nodeAg);
-					}
-					catch(const std::runtime_error& re)
-					{
-					    // speciffic handling for runtime_error
-						std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
-					    std::cerr << "Runtime error: " << re.what() << std::endl;
-						PRINT_STACK_TRACE
-					}
-					catch(const std::exception& ex)
-					{
-					    // speciffic handling for all exceptions extending std::exception, except
-					    // std::runtime_error which is handled explicitly
-						std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
-					    std::cerr << "Error occurred: " << ex.what() << std::endl;
-						PRINT_STACK_TRACE
-					}
-					catch(...)
-					{
-						std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
-						std::cerr << " Iterator key: " << it->first << std::endl;
-						PRINT_STACK_TRACE
-						MPI_Finalize();
-						exit(EXIT_FAILURE);
-					}
+					continue;
 				}
-			}
-			catch(const std::runtime_error& re)
-			{
-			    // speciffic handling for runtime_error
-				std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
-			    std::cerr << "Runtime error: " << re.what() << std::endl;
-				PRINT_STACK_TRACE
-			}
-			catch(const std::exception& ex)
-			{
-			    // speciffic handling for all exceptions extending std::exception, except
-			    // std::runtime_error which is handled explicitly
-				std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
-			    std::cerr << "Error occurred: " << ex.what() << std::endl;
-				PRINT_STACK_TRACE
-			}
-			catch(...)
-			{
-				std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
-				std::cerr << " Iterator key: " << it->first << std::endl;
-				PRINT_STACK_TRACE
-				MPI_Finalize();
-				exit(EXIT_FAILURE);
-			}
 
-			try
-			{
-				simulationData.push_back(iterationData);
-				//printf ("%d rank - Saving simulating data: (%f seconds).\n", myRank,((float)clock() - savingDataStartTime)/CLOCKS_PER_SEC);
-			}
-			catch(const std::runtime_error& re)
-			{
-			    // speciffic handling for runtime_error
-				std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
-			    std::cerr << "Runtime error: " << re.what() << std::endl;
-				PRINT_STACK_TRACE
-			}
-			catch(const std::exception& ex)
-			{
-			    // speciffic handling for all exceptions extending std::exception, except
-			    // std::runtime_error which is handled explicitly
-				std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
-			    std::cerr << "Error occurred: " << ex.what() << std::endl;
-				PRINT_STACK_TRACE
-			}
-			catch(...)
-			{
-				std::cerr << " Error occured at file " << __FILE__ << " function: " << __FUNCTION__ << " line: " << __LINE__ << std::endl;
-				PRINT_STACK_TRACE
-				MPI_Finalize();
-				exit(EXIT_FAILURE);
+				savingFrame.ids.push_back(id);
+				savingFrame.xs.push_back(AgentsPositions[id].x());
+				savingFrame.ys.push_back(AgentsPositions[id].y());
+				savingFrame.flags.push_back(AgentsDeleted[id] ? TRAJECTORY_AGENT_DELETED : 0);
 			}
 
-			//Writing to file if the current iteration is even to predefined
-			if(currentIteration %  iterationForWritingToFile == 0)
-			{
-				//WriteToFilePlainTextSavedModelingInfo(filename, simulationData);
-				WriteToFileBinarySavedModelingInfo(filename, simulationData);
-			}
-		}			
+			trajectoryWriter->Push(savingFrame);
+			//printf ("%d rank - Saving simulating data: (%f seconds).\n", myRank,((float)clock() - savingDataStartTime)/CLOCKS_PER_SEC);
+		}
 	}
 	catch (std::bad_alloc& ba) 
 	{
@@ -0,0 +1,111 @@
+// This is an independent project of an individual developer. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "TrajectoryCodec.h"
+#include <cmath>
+
+void TrajectoryCodec::WriteVarint(unsigned long long value, std::vector<unsigned char> &output)
+{
+	while(value >= 0x80)
+	{
+		output.push_back((unsigned char)(value | 0x80));
+		value >>= 7;
+	}
+	output.push_back((unsigned char)value);
+}
+
+unsigned long long TrajectoryCodec::ReadVarint(const unsigned char* &data)
+{
+	unsigned long long value = 0;
+	int shift = 0;
+	while(*data & 0x80)
+	{
+		value |= (unsigned long long)(*data & 0x7F) << shift;
+		shift += 7;
+		data++;
+	}
+	value |= (unsigned long long)(*data) << shift;
+	data++;
+	return value;
+}
+
+//Token 0 is followed by a run length of zero differences, other tokens are zigzag mapped difference plus one
+void TrajectoryCodec::Encode(const std::vector<float> &values, std::vector<long long> &reference, bool keyframe, float precision, std::vector<unsigned char> &output)
+{
+	size_t count = values.size();
+	if(keyframe)
+	{
+		reference.assign(count, 0);
+	}
+
+	size_t zerosRun = 0;
+	for(size_t i = 0; i < count; i++)
+	{
+		long long quantized = (long long)floor(values[i] / precision + 0.5);
+		long long difference = quantized - reference[i];
+		reference[i] = quantized;
+
+		if(difference == 0)
+		{
+			zerosRun++;
+			continue;
+		}
+
+		if(zerosRun == 1)
+		{
+			WriteVarint(1, output);
+		}
+		else if(zerosRun > 1)
+		{
+			WriteVarint(0, output);
+			WriteVarint(zerosRun, output);
+		}
+		zerosRun = 0;
+
+		unsigned long long zigzag = ((unsigned long long)difference << 1) ^ (unsigned long long)(difference >> 63);
+		WriteVarint(zigzag + 1, output);
+	}
+
+	if(zerosRun == 1)
+	{
+		WriteVarint(1, output);
+	}
+	else if(zerosRun > 1)
+	{
+		WriteVarint(0, output);
+		WriteVarint(zerosRun, output);
+	}
+}
+
+size_t TrajectoryCodec::Decode(const unsigned char* data, size_t count, std::vector<long long> &reference, bool keyframe, float precision, std::vector<float> &values)
+{
+	const unsigned char* p = data;
+	if(keyframe)
+	{
+		reference.assign(count, 0);
+	}
+	values.resize(count);
+
+	size_t i = 0;
+	while(i < count)
+	{
+		unsigned long long token = ReadVarint(p);
+		if(token == 0)
+		{
+			size_t zerosRun = ReadVarint(p);
+			for(size_t j = 0; j < zerosRun && i < count; j++, i++)
+			{
+				values[i] = reference[i] * precision;
+			}
+			continue;
+		}
+
+		unsigned long long zigzag = token - 1;
+		long long difference = (long long)(zigzag >> 1) ^ -(long long)(zigzag & 1);
+		reference[i] += difference;
+		values[i] = reference[i] * precision;
+		i++;
+	}
+
+	return p - data;
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+//Coordinates are quantized to fixed point with given precision and stored as differences with reference values (previous frame, zeros for keyframes).
+//Differences are zigzag mapped and written as variable length integers, runs of zero differences take two bytes at most
+class TrajectoryCodec
+{
+public:
+	//Appends encoded values to the output, reference is replaced with the quantized values
+	static void Encode(const std::vector<float> &values, std::vector<long long> &reference, bool keyframe, float precision, std::vector<unsigned char> &output);
+	//Decodes count values starting at data, reference is replaced with the quantized values. Returns count of consumed bytes
+	static size_t Decode(const unsigned char* data, size_t count, std::vector<long long> &reference, bool keyframe, float precision, std::vector<float> &values);
+
+private:
+	static void WriteVarint(unsigned long long value, std::vector<unsigned char> &output);
+	static unsigned long long ReadVarint(const unsigned char* &data);
+};
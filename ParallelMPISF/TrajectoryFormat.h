@@ -0,0 +1,95 @@
+#pragma once
+#include <algorithm>
+#include <vector>
+
+//Trajectory file layout, all values are little endian:
+//	header:	magic "DSFTRAJ", format version, header size, positions compression parameters
+//	frames:	frame header, then columns: IDs (long long), x (float), y (float), flags (unsigned char); each frame is padded to 8 bytes.
+//			IDs column is omitted if the frame has the same IDs as the previous one, the index points to the column to use.
+//			In compressed frames x and y columns are replaced with one positions block encoded by TrajectoryCodec,
+//			it depends on previous frames down to the nearest keyframe
+//	index:	one entry per frame
+//	footer:	index offset, frames count, magic "DSFINDEX"
+const char TRAJECTORY_MAGIC[8] = {'D', 'S', 'F', 'T', 'R', 'A', 'J', '\0'};
+const char TRAJECTORY_INDEX_MAGIC[8] = {'D', 'S', 'F', 'I', 'N', 'D', 'E', 'X'};
+const int TRAJECTORY_FORMAT_VERSION = 2;
+
+const unsigned char TRAJECTORY_AGENT_DELETED = 1; //bit of the flags column
+
+//bits of the frame flags
+const int TRAJECTORY_FRAME_HAS_IDS = 1;
+const int TRAJECTORY_FRAME_COMPRESSED = 2;
+const int TRAJECTORY_FRAME_KEYFRAME = 4; //compressed frame which doesnt depend on previous ones
+
+enum TrajectoryColumn
+{
+	IDsColumn,
+	XColumn,
+	YColumn,
+	FlagsColumn
+};
+
+struct TrajectoryFileHeader
+{
+	char magic[8];
+	int version;
+	int headerSize;
+	int compressed;
+	float precision;		//fixed point step of compressed positions
+	int keyframeInterval;
+	int reserved;
+};
+
+struct TrajectoryFrameHeader
+{
+	int iteration;
+	int agentsCount;
+	int flags;
+	int positionsSize;	//bytes of the compressed positions block
+};
+
+struct TrajectoryIndexEntry
+{
+	int iteration;
+	int agentsCount;
+	long long frameOffset;	//offset of the frame header
+	long long idsOffset;	//offset of the IDs column, it can belong to one of previous frames
+	int flags;
+	int positionsSize;
+};
+
+struct TrajectoryFileFooter
+{
+	long long indexOffset;
+	long long framesCount;
+	char magic[8];
+};
+
+//Agents state of one iteration in structure of arrays layout, all arrays are indexed the same way
+struct TrajectoryFrame
+{
+	int iteration;
+	std::vector<long long> ids;
+	std::vector<float> xs;
+	std::vector<float> ys;
+	std::vector<unsigned char> flags;
+
+	TrajectoryFrame(void) : iteration(0) { }
+
+	void Clear()
+	{
+		ids.clear();
+		xs.clear();
+		ys.clear();
+		flags.clear();
+	}
+
+	void Swap(TrajectoryFrame &other)
+	{
+		std::swap(iteration, other.iteration);
+		ids.swap(other.ids);
+		xs.swap(other.xs);
+		ys.swap(other.ys);
+		flags.swap(other.flags);
+	}
+};
@@ -0,0 +1,181 @@
+// This is an independent project of an individual developer. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "TrajectoryReader.h"
+#include "TrajectoryCodec.h"
+#include <cstring>
+#include <stdexcept>
+
+TrajectoryReader::TrajectoryReader(const std::string &path) : _decodedFrame(-1)
+{
+	_file = fopen(path.c_str(), "rb");
+	if(_file == NULL)
+	{
+		throw std::runtime_error("Cannot open trajectory file " + path);
+	}
+
+	ReadBytes(&_header, sizeof(_header));
+	if(memcmp(_header.magic, TRAJECTORY_MAGIC, sizeof(_header.magic)) != 0 || _header.version != TRAJECTORY_FORMAT_VERSION)
+	{
+		fclose(_file);
+		throw std::runtime_error("Unsupported trajectory file " + path);
+	}
+
+	TrajectoryFileFooter footer;
+#ifdef _WIN32
+	_fseeki64(_file, -(long long)sizeof(footer), SEEK_END);
+#else
+	fseeko(_file, -(off_t)sizeof(footer), SEEK_END);
+#endif
+	ReadBytes(&footer, sizeof(footer));
+	if(memcmp(footer.magic, TRAJECTORY_INDEX_MAGIC, sizeof(footer.magic)) != 0)
+	{
+		fclose(_file);
+		throw std::runtime_error("Trajectory file " + path + " has no index, probably writing wasnt finished");
+	}
+
+	_index.resize(footer.framesCount);
+	Seek(footer.indexOffset);
+	ReadBytes(_index.empty() ? NULL : &_index[0], _index.size() * sizeof(TrajectoryIndexEntry));
+}
+
+void TrajectoryReader::Seek(long long offset)
+{
+#ifdef _WIN32
+	_fseeki64(_file, offset, SEEK_SET);
+#else
+	fseeko(_file, offset, SEEK_SET);
+#endif
+}
+
+void TrajectoryReader::ReadBytes(void* data, size_t size)
+{
+	if(size > 0 && fread(data, 1, size, _file) != size)
+	{
+		throw std::runtime_error("Unexpected end of trajectory file");
+	}
+}
+
+//Iterations are saved in increasing order
+int TrajectoryReader::FindFrame(int iteration) const
+{
+	size_t low = 0;
+	size_t high = _index.size();
+	while(low < high)
+	{
+		size_t middle = (low + high) / 2;
+		if(_index[middle].iteration < iteration)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+
+	if(low < _index.size() && _index[low].iteration == iteration)
+	{
+		return low;
+	}
+	return -1;
+}
+
+long long TrajectoryReader::ColumnOffset(size_t frame, TrajectoryColumn column) const
+{
+	const TrajectoryIndexEntry &entry = _index[frame];
+	long long columnsOffset = entry.frameOffset + sizeof(TrajectoryFrameHeader);
+	long long agentsCount = entry.agentsCount;
+	if(entry.flags & TRAJECTORY_FRAME_HAS_IDS)
+	{
+		columnsOffset += agentsCount * sizeof(long long);
+	}
+	bool compressed = (entry.flags & TRAJECTORY_FRAME_COMPRESSED) != 0;
+
+	switch(column)
+	{
+	case IDsColumn:
+		return entry.idsOffset;
+	case XColumn:
+		return columnsOffset;
+	case YColumn:
+		return compressed ? columnsOffset + entry.positionsSize : columnsOffset + agentsCount * sizeof(float);
+	default:
+		return compressed ? columnsOffset + entry.positionsSize : columnsOffset + 2 * agentsCount * sizeof(float);
+	}
+}
+
+long long TrajectoryReader::ColumnSize(size_t frame, TrajectoryColumn column) const
+{
+	long long agentsCount = _index[frame].agentsCount;
+	bool compressed = (_index[frame].flags & TRAJECTORY_FRAME_COMPRESSED) != 0;
+	switch(column)
+	{
+	case IDsColumn:
+		return agentsCount * sizeof(long long);
+	case XColumn:
+		return compressed ? _index[frame].positionsSize : agentsCount * sizeof(float);
+	case YColumn:
+		return compressed ? 0 : agentsCount * sizeof(float);
+	default:
+		return agentsCount * sizeof(unsigned char);
+	}
+}
+
+void TrajectoryReader::ReadFrame(size_t frame, TrajectoryFrame &result)
+{
+	size_t agentsCount = _index[frame].agentsCount;
+	result.iteration = _index[frame].iteration;
+	result.ids.resize(agentsCount);
+	result.xs.resize(agentsCount);
+	result.ys.resize(agentsCount);
+	result.flags.resize(agentsCount);
+	if(agentsCount == 0)
+	{
+		return;
+	}
+
+	Seek(ColumnOffset(frame, IDsColumn));
+	ReadBytes(&result.ids[0], ColumnSize(frame, IDsColumn));
+	if(_index[frame].flags & TRAJECTORY_FRAME_COMPRESSED)
+	{
+		DecodePositions(frame, result);
+	}
+	else
+	{
+		//x, y and flags columns are adjacent
+		Seek(ColumnOffset(frame, XColumn));
+		ReadBytes(&result.xs[0], ColumnSize(frame, XColumn));
+		ReadBytes(&result.ys[0], ColumnSize(frame, YColumn));
+	}
+	Seek(ColumnOffset(frame, FlagsColumn));
+	ReadBytes(&result.flags[0], ColumnSize(frame, FlagsColumn));
+}
+
+//Walking back stops at a keyframe or right after the last decoded frame, whose reference values continue the decoding
+void TrajectoryReader::DecodePositions(size_t frame, TrajectoryFrame &result)
+{
+	long long first = frame;
+	while(first != _decodedFrame + 1 && !(_index[first].flags & TRAJECTORY_FRAME_KEYFRAME))
+	{
+		first--;
+	}
+
+	for(size_t current = first; current <= frame; current++)
+	{
+		const TrajectoryIndexEntry &entry = _index[current];
+		bool keyframe = (entry.flags & TRAJECTORY_FRAME_KEYFRAME) != 0;
+		_encoded.resize(entry.positionsSize + 1);
+		Seek(ColumnOffset(current, XColumn));
+		ReadBytes(&_encoded[0], entry.positionsSize);
+
+		size_t consumed = TrajectoryCodec::Decode(&_encoded[0], entry.agentsCount, _referenceX, keyframe, _header.precision, result.xs);
+		TrajectoryCodec::Decode(&_encoded[consumed], entry.agentsCount, _referenceY, keyframe, _header.precision, result.ys);
+		_decodedFrame = current;
+	}
+}
+
+TrajectoryReader::~TrajectoryReader(void)
+{
+	fclose(_file);
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "TrajectoryFormat.h"
+
+//Reads trajectory files written by TrajectoryWriter. Any frame is found by the footer index, compressed frames are decoded from the nearest keyframe
+class TrajectoryReader
+{
+public:
+	TrajectoryReader(const std::string &path);
+	size_t FramesCount() const { return _index.size(); }
+	const TrajectoryIndexEntry& Frame(size_t frame) const { return _index[frame]; }
+	//Frame of the iteration, -1 if the iteration wasnt saved
+	int FindFrame(int iteration) const;
+	void ReadFrame(size_t frame, TrajectoryFrame &result);
+	//Place of one column in the file, so a caller can read or memory map only it.
+	//In compressed frames x column is the whole positions block and y column is empty
+	long long ColumnOffset(size_t frame, TrajectoryColumn column) const;
+	long long ColumnSize(size_t frame, TrajectoryColumn column) const;
+	~TrajectoryReader(void);
+
+private:
+	void Seek(long long offset);
+	void ReadBytes(void* data, size_t size);
+	void DecodePositions(size_t frame, TrajectoryFrame &result);
+
+	FILE* _file;
+	TrajectoryFileHeader _header;
+	std::vector<TrajectoryIndexEntry> _index;
+	//Decoding state of compressed frames, sequential reading continues from the last decoded frame
+	long long _decodedFrame;
+	std::vector<long long> _referenceX;
+	std::vector<long long> _referenceY;
+	std::vector<unsigned char> _encoded;
+};
@@ -0,0 +1,252 @@
+// This is an independent project of an individual developer. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "TrajectoryWriter.h"
+#include "TrajectoryCodec.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <iostream>
+
+#ifdef _WIN32
+#include <process.h>
+#endif
+
+TrajectoryWriter::TrajectoryWriter(const std::string &path, bool compressed, float precision, int keyframeInterval) : _path(path), _failed(false), _fileBuffer(4 << 20), _offset(0), _lastIDsOffset(-1),
+	_compressed(compressed), _precision(precision), _keyframeInterval(keyframeInterval), _framesSinceKeyframe(0), _head(0), _pending(0), _closing(false), _closed(false)
+{
+	_file = fopen(path.c_str(), "wb");
+	if(_file == NULL)
+	{
+		throw std::runtime_error("Cannot open trajectory file " + path);
+	}
+	setvbuf(_file, &_fileBuffer[0], _IOFBF, _fileBuffer.size());
+
+	TrajectoryFileHeader header;
+	memcpy(header.magic, TRAJECTORY_MAGIC, sizeof(header.magic));
+	header.version = TRAJECTORY_FORMAT_VERSION;
+	header.headerSize = sizeof(TrajectoryFileHeader);
+	header.compressed = compressed ? 1 : 0;
+	header.precision = precision;
+	header.keyframeInterval = keyframeInterval;
+	header.reserved = 0;
+	WriteBytes(&header, sizeof(header));
+
+#ifdef _WIN32
+	InitializeCriticalSection(&_mutex);
+	InitializeConditionVariable(&_condition);
+	_thread = (HANDLE)_beginthreadex(NULL, 0, ThreadFunction, this, 0, NULL);
+#else
+	pthread_mutex_init(&_mutex, NULL);
+	pthread_cond_init(&_condition, NULL);
+	pthread_create(&_thread, NULL, ThreadFunction, this);
+#endif
+}
+
+#ifdef _WIN32
+unsigned __stdcall TrajectoryWriter::ThreadFunction(void* writer)
+{
+	static_cast<TrajectoryWriter*>(writer)->Run();
+	return 0;
+}
+#else
+void* TrajectoryWriter::ThreadFunction(void* writer)
+{
+	static_cast<TrajectoryWriter*>(writer)->Run();
+	return NULL;
+}
+#endif
+
+void TrajectoryWriter::Lock()
+{
+#ifdef _WIN32
+	EnterCriticalSection(&_mutex);
+#else
+	pthread_mutex_lock(&_mutex);
+#endif
+}
+
+void TrajectoryWriter::Unlock()
+{
+#ifdef _WIN32
+	LeaveCriticalSection(&_mutex);
+#else
+	pthread_mutex_unlock(&_mutex);
+#endif
+}
+
+void TrajectoryWriter::Wait()
+{
+#ifdef _WIN32
+	SleepConditionVariableCS(&_condition, &_mutex, INFINITE);
+#else
+	pthread_cond_wait(&_condition, &_mutex);
+#endif
+}
+
+void TrajectoryWriter::NotifyAll()
+{
+#ifdef _WIN32
+	WakeAllConditionVariable(&_condition);
+#else
+	pthread_cond_broadcast(&_condition);
+#endif
+}
+
+void TrajectoryWriter::Push(TrajectoryFrame &frame)
+{
+	Lock();
+	while(_pending == 2)
+	{
+		Wait();
+	}
+	TrajectoryFrame &buffer = _buffers[(_head + _pending) % 2];
+	buffer.Swap(frame);
+	frame.Clear();
+	_pending++;
+	NotifyAll();
+	Unlock();
+}
+
+//Writer thread loop. The oldest full buffer is written without the lock, Push never touches it while it is pending
+void TrajectoryWriter::Run()
+{
+	Lock();
+	while(true)
+	{
+		while(_pending == 0 && !_closing)
+		{
+			Wait();
+		}
+		if(_pending == 0)
+		{
+			break;
+		}
+
+		const TrajectoryFrame &frame = _buffers[_head];
+		Unlock();
+		WriteFrame(frame);
+		Lock();
+
+		_head = (_head + 1) % 2;
+		_pending--;
+		NotifyAll();
+	}
+	Unlock();
+}
+
+void TrajectoryWriter::WriteBytes(const void* data, size_t size)
+{
+	if(size > 0)
+	{
+		if(fwrite(data, 1, size, _file) != size)
+		{
+			_failed = true;
+		}
+		_offset += size;
+	}
+}
+
+//Columns are written straight from the frame arrays, IDs column is skipped if it repeats the last written one.
+//Compressed positions are differences with the last frame, so a keyframe is forced when IDs change
+void TrajectoryWriter::WriteFrame(const TrajectoryFrame &frame)
+{
+	TrajectoryIndexEntry entry;
+	entry.iteration = frame.iteration;
+	entry.agentsCount = frame.ids.size();
+	entry.frameOffset = _offset;
+	entry.positionsSize = 0;
+
+	bool sameIDs = _lastIDsOffset >= 0 && _lastIDs == frame.ids;
+	entry.flags = sameIDs ? 0 : TRAJECTORY_FRAME_HAS_IDS;
+	if(_compressed)
+	{
+		bool keyframe = !sameIDs || _framesSinceKeyframe >= _keyframeInterval - 1;
+		_framesSinceKeyframe = keyframe ? 0 : _framesSinceKeyframe + 1;
+		entry.flags |= TRAJECTORY_FRAME_COMPRESSED | (keyframe ? TRAJECTORY_FRAME_KEYFRAME : 0);
+
+		_encoded.clear();
+		TrajectoryCodec::Encode(frame.xs, _referenceX, keyframe, _precision, _encoded);
+		TrajectoryCodec::Encode(frame.ys, _referenceY, keyframe, _precision, _encoded);
+		entry.positionsSize = _encoded.size();
+	}
+
+	TrajectoryFrameHeader frameHeader;
+	frameHeader.iteration = frame.iteration;
+	frameHeader.agentsCount = entry.agentsCount;
+	frameHeader.flags = entry.flags;
+	frameHeader.positionsSize = entry.positionsSize;
+	WriteBytes(&frameHeader, sizeof(frameHeader));
+
+	if(sameIDs)
+	{
+		entry.idsOffset = _lastIDsOffset;
+	}
+	else
+	{
+		entry.idsOffset = _offset;
+		_lastIDsOffset = _offset;
+		_lastIDs = frame.ids;
+		WriteBytes(frame.ids.empty() ? NULL : &frame.ids[0], frame.ids.size() * sizeof(long long));
+	}
+	if(_compressed)
+	{
+		WriteBytes(_encoded.empty() ? NULL : &_encoded[0], _encoded.size());
+	}
+	else
+	{
+		WriteBytes(frame.xs.empty() ? NULL : &frame.xs[0], frame.xs.size() * sizeof(float));
+		WriteBytes(frame.ys.empty() ? NULL : &frame.ys[0], frame.ys.size() * sizeof(float));
+	}
+	WriteBytes(frame.flags.empty() ? NULL : &frame.flags[0], frame.flags.size());
+
+	const char padding[8] = {0};
+	WriteBytes(padding, (8 - _offset % 8) % 8);
+
+	_index.push_back(entry);
+}
+
+void TrajectoryWriter::Close()
+{
+	if(_closed)
+	{
+		return;
+	}
+
+	Lock();
+	_closing = true;
+	NotifyAll();
+	Unlock();
+
+#ifdef _WIN32
+	WaitForSingleObject(_thread, INFINITE);
+	CloseHandle(_thread);
+	DeleteCriticalSection(&_mutex);
+#else
+	pthread_join(_thread, NULL);
+	pthread_mutex_destroy(&_mutex);
+	pthread_cond_destroy(&_condition);
+#endif
+
+	TrajectoryFileFooter footer;
+	footer.indexOffset = _offset;
+	footer.framesCount = _index.size();
+	memcpy(footer.magic, TRAJECTORY_INDEX_MAGIC, sizeof(footer.magic));
+	WriteBytes(_index.empty() ? NULL : &_index[0], _index.size() * sizeof(TrajectoryIndexEntry));
+	WriteBytes(&footer, sizeof(footer));
+
+	if(fclose(_file) != 0)
+	{
+		_failed = true;
+	}
+	_closed = true;
+	if(_failed)
+	{
+		std::cerr << "Trajectory file " << _path << " is incomplete, writing to it failed" << std::endl;
+	}
+}
+
+TrajectoryWriter::~TrajectoryWriter(void)
+{
+	Close();
+}
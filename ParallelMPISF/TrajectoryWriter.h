@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "TrajectoryFormat.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+//Writes trajectory frames to a file on a background thread. Frames are handed over through two buffers, so the simulation waits only when the writer is two frames behind
+class TrajectoryWriter
+{
+public:
+	//Compressed positions are quantized with given precision, a keyframe is written at least every keyframeInterval frames
+	TrajectoryWriter(const std::string &path, bool compressed = false, float precision = 0.001f, int keyframeInterval = 10);
+	//Frame content is moved to a free buffer, the frame gets back an empty buffer which keeps its capacity
+	void Push(TrajectoryFrame &frame);
+	//Writes remaining frames, stops the thread and closes the file. Prints an error if some data wasnt written, the file is incomplete then
+	void Close();
+	~TrajectoryWriter(void);
+
+private:
+	void Run();
+	void WriteFrame(const TrajectoryFrame &frame);
+	void WriteBytes(const void* data, size_t size);
+	void Lock();
+	void Unlock();
+	void Wait();
+	void NotifyAll();
+#ifdef _WIN32
+	static unsigned __stdcall ThreadFunction(void* writer);
+#else
+	static void* ThreadFunction(void* writer);
+#endif
+
+	std::string _path;
+	FILE* _file;
+	bool _failed;	//some write failed, e.g. the disk is full
+	std::vector<char> _fileBuffer;
+	long long _offset;	//current file size
+	std::vector<long long> _lastIDs;	//IDs column of the last written frame
+	long long _lastIDsOffset;
+	std::vector<TrajectoryIndexEntry> _index;
+	bool _compressed;
+	float _precision;
+	int _keyframeInterval;
+	int _framesSinceKeyframe;
+	std::vector<long long> _referenceX;	//quantized positions of the last written frame
+	std::vector<long long> _referenceY;
+	std::vector<unsigned char> _encoded;
+	TrajectoryFrame _buffers[2];
+	int _head;		//oldest full buffer
+	int _pending;	//full buffers count
+	bool _closing;
+	bool _closed;
+
+#ifdef _WIN32
+	HANDLE _thread;
+	CRITICAL_SECTION _mutex;
+	CONDITION_VARIABLE _condition;
+#else
+	pthread_t _thread;
+	pthread_mutex_t _mutex;
+	pthread_cond_t _condition;
+#endif
+};